@@ -0,0 +1,199 @@
+// Breakdown operations for one width, included by main.c once per width with
+// BREAKDOWN_OPS_WIDTH set to 16, 32 or 64 counts. Counts past the alphabet's
+// letters are always zero, so only the lanes within the width are looked at,
+// and all loop bounds are compile-time constants.
+
+#define BREAKDOWN_OPS_LANES (BREAKDOWN_OPS_WIDTH / 8)
+#define BREAKDOWN_OPS_PACKED_LANES ((BREAKDOWN_OPS_WIDTH + 15) / 16)
+#define breakdown_op_paste(name, width) name##_##width
+#define breakdown_op_with_width(name, width) breakdown_op_paste(name, width)
+#define breakdown_op(name) breakdown_op_with_width(name, BREAKDOWN_OPS_WIDTH)
+
+internal b32 breakdown_op(breakdown_eq)(breakdown_t* a, breakdown_t* b)
+{
+  u64 different = 0;
+
+  for(u32 lane = 0;
+      lane < BREAKDOWN_OPS_LANES;
+      ++lane)
+  {
+    different |= (a->lanes[lane] ^ b->lanes[lane]);
+  }
+
+  return !different;
+}
+
+internal b32 breakdown_op(breakdown_is_empty)(breakdown_t* a)
+{
+  u64 any = 0;
+
+  for(u32 lane = 0;
+      lane < BREAKDOWN_OPS_LANES;
+      ++lane)
+  {
+    any |= a->lanes[lane];
+  }
+
+  return !any;
+}
+
+internal b32 breakdown_op(breakdown_underflowed)(breakdown_t* a)
+{
+  u64 signs = 0;
+
+  for(u32 lane = 0;
+      lane < BREAKDOWN_OPS_LANES;
+      ++lane)
+  {
+    signs |= (a->lanes[lane] & BREAKDOWN_LANE_SIGNS);
+  }
+
+  return signs != 0;
+}
+
+// Both breakdowns must be non-negative.
+internal b32 breakdown_op(breakdown_contains)(breakdown_t* a, breakdown_t* b)
+{
+  u64 borrows = 0;
+
+  for(u32 lane = 0;
+      lane < BREAKDOWN_OPS_LANES;
+      ++lane)
+  {
+    // A count's guard bit is borrowed from exactly when b's count is bigger.
+    borrows |= ~((a->lanes[lane] | BREAKDOWN_LANE_SIGNS) - b->lanes[lane]);
+  }
+
+  return !(borrows & BREAKDOWN_LANE_SIGNS);
+}
+
+internal void breakdown_op(breakdown_add)(breakdown_t* a, breakdown_t* b)
+{
+  for(u32 lane = 0;
+      lane < BREAKDOWN_OPS_LANES;
+      ++lane)
+  {
+    // Per-count addition, without carries between counts.
+    u64 x = a->lanes[lane];
+    u64 y = b->lanes[lane];
+    a->lanes[lane] = ((x & ~BREAKDOWN_LANE_SIGNS) + (y & ~BREAKDOWN_LANE_SIGNS))
+      ^ ((x ^ y) & BREAKDOWN_LANE_SIGNS);
+  }
+}
+
+// Returns false if any count went negative.
+internal b32 breakdown_op(breakdown_subtract)(breakdown_t* a, breakdown_t* b)
+{
+  for(u32 lane = 0;
+      lane < BREAKDOWN_OPS_LANES;
+      ++lane)
+  {
+    // Per-count subtraction, without borrows between counts.
+    u64 x = a->lanes[lane];
+    u64 y = b->lanes[lane];
+    a->lanes[lane] = ((x | BREAKDOWN_LANE_SIGNS) - (y & ~BREAKDOWN_LANE_SIGNS))
+      ^ ((x ^ ~y) & BREAKDOWN_LANE_SIGNS);
+  }
+
+  return !breakdown_op(breakdown_underflowed)(a);
+}
+
+internal i32 breakdown_op(breakdown_sum)(breakdown_t* a)
+{
+  i32 sum = 0;
+
+  for(u32 idx = 0;
+      idx < BREAKDOWN_OPS_WIDTH;
+      ++idx)
+  {
+    sum += a->counts[idx];
+  }
+
+  return sum;
+}
+
+internal void breakdown_op(breakdown_max0)(breakdown_t* a)
+{
+  for(u32 idx = 0;
+      idx < BREAKDOWN_OPS_WIDTH;
+      ++idx)
+  {
+    a->counts[idx] = max(0, a->counts[idx]);
+  }
+}
+
+// Sum of the negative counts, i.e. how many letters wildcards have to fill in.
+internal i32 breakdown_op(breakdown_deficit)(breakdown_t* a)
+{
+  i32 deficit = 0;
+
+  for(u32 lane = 0;
+      lane < BREAKDOWN_OPS_LANES;
+      ++lane)
+  {
+    u64 x = a->lanes[lane];
+    u64 is_negative = ((x & BREAKDOWN_LANE_SIGNS) >> 7) * 0xff;
+    // Per-count negation, as in breakdown_subtract from zero.
+    u64 negated = (BREAKDOWN_LANE_SIGNS - (x & ~BREAKDOWN_LANE_SIGNS)) ^ (~x & BREAKDOWN_LANE_SIGNS);
+    u64 bytes = negated & is_negative;
+    u64 pairs = (bytes & 0x00ff00ff00ff00ffull) + ((bytes >> 8) & 0x00ff00ff00ff00ffull);
+    deficit += (i32)((pairs * 0x0001000100010001ull) >> 48);
+  }
+
+  return deficit;
+}
+
+internal b32 breakdown_op(breakdown_fits_packed_key)(breakdown_t* breakdown)
+{
+  u64 high_bits = 0;
+
+  for(u32 lane = 0;
+      lane < BREAKDOWN_OPS_LANES;
+      ++lane)
+  {
+    high_bits |= breakdown->lanes[lane] & ~PACKED_KEY_LOW_NIBBLES;
+  }
+
+  return high_bits == 0;
+}
+
+internal b32 breakdown_op(packed_key_eq)(packed_key_t* a, packed_key_t* b)
+{
+  u64 different = 0;
+
+  for(u32 lane = 0;
+      lane < BREAKDOWN_OPS_PACKED_LANES;
+      ++lane)
+  {
+    different |= (a->lanes[lane] ^ b->lanes[lane]);
+  }
+
+  return !different;
+}
+
+internal b32 breakdown_op(packed_key_contains)(packed_key_t* a, packed_key_t* b)
+{
+  u64 guards = PACKED_KEY_GUARDS;
+
+  for(u32 lane = 0;
+      lane < BREAKDOWN_OPS_PACKED_LANES;
+      ++lane)
+  {
+    // Even and odd nibbles are spread into bytes, each with a guard bit above
+    // that is borrowed from exactly when b's count is bigger.
+    u64 a_even = (a->lanes[lane] & PACKED_KEY_LOW_NIBBLES) | PACKED_KEY_GUARDS;
+    u64 a_odd = ((a->lanes[lane] >> 4) & PACKED_KEY_LOW_NIBBLES) | PACKED_KEY_GUARDS;
+    u64 b_even = b->lanes[lane] & PACKED_KEY_LOW_NIBBLES;
+    u64 b_odd = (b->lanes[lane] >> 4) & PACKED_KEY_LOW_NIBBLES;
+    guards &= (a_even - b_even) & (a_odd - b_odd);
+  }
+
+  return guards == PACKED_KEY_GUARDS;
+}
+
+#undef breakdown_op
+#undef breakdown_op_with_width
+#undef breakdown_op_paste
+#undef BREAKDOWN_OPS_PACKED_LANES
+#undef BREAKDOWN_OPS_LANES
+#undef BREAKDOWN_OPS_WIDTH
@@ -3,184 +3,572 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include <termios.h>
 #include <signal.h>
+#include <time.h>
 #include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "util.h"
 
-typedef struct
+// Alphabets with more letters than this need a wider build (-DBREAKDOWN_WIDTH=64).
+#ifndef BREAKDOWN_WIDTH
+#define BREAKDOWN_WIDTH 32
+#endif
+#if BREAKDOWN_WIDTH != 32 && BREAKDOWN_WIDTH != 64
+#error "BREAKDOWN_WIDTH must be 32 or 64"
+#endif
+
+typedef union
 {
-  i8 counts[27];
+  i8 counts[BREAKDOWN_WIDTH];
+  u64 lanes[BREAKDOWN_WIDTH / 8];
 } breakdown_t;
 
 typedef struct wordlink_t
 {
   str_t word;
+  u32 sources;  // Bit mask of the dictionaries the word appeared in.
   struct wordlink_t* next;
 } wordlink_t;
 
+// Stored keys pack each count into 4 bits; words with more than 15 of a letter are
+// skipped, with a warning after loading.
+#define PACKED_KEY_MAX_COUNT 15
+
+typedef struct
+{
+  u64 lanes[BREAKDOWN_WIDTH / 16];
+} packed_key_t;
+
 typedef struct keylink_t
 {
-  breakdown_t key;
+  packed_key_t key;
+  u32 word_count;
   wordlink_t first_word;
 
   struct keylink_t* next;
 } keylink_t;
 
+// Per-query copy of a key that fits into the input, with its non-excluded words.
+typedef struct subkey_t
+{
+  breakdown_t key;
+  wordlink_t first_word;
+
+  struct subkey_t* next;
+} subkey_t;
+
+// Why a search ended before listing everything.
+typedef enum
+{
+  STOP_NONE,
+  STOP_MAX_RESULTS,
+  STOP_DEADLINE,
+  STOP_MEMORY,
+  STOP_CANCELLED,
+} stop_reason_t;
+
+internal char* stop_reason_names[] = {
+  "finished", "result limit", "time limit", "memory limit", "cancellation",
+};
+
+// How multi-word anagrams are searched, chosen with --engine.
+typedef enum
+{
+  SEARCH_ENGINE_CHAIN,  // Depth-first over candidate chains, longest words first.
+  SEARCH_ENGINE_COVER,  // Exact cover, covering the most constrained letter first.
+  SEARCH_ENGINE_COUNT,
+} search_engine_t;
+
+internal char* search_engine_names[] = {
+  "chain", "cover",
+};
+
+static search_engine_t global_search_engine = SEARCH_ENGINE_CHAIN;
+
+// Lets a running search be stopped from a signal handler or another thread,
+// and tells how far it got. Searches look at it between slices of steps.
+typedef struct
+{
+  volatile sig_atomic_t cancelled;
+  // Called with the fraction of the top-level candidates explored.
+  void (*report_progress)(void* data, f64 progress);
+  void* progress_data;
+} search_control_t;
+
+// Per-query limits, 0 for none.
+typedef struct
+{
+  u64 timeout_ns;
+  size_t memory_budget;  // Bytes of arena blocks a query may add.
+  search_control_t* control;
+} query_limits_t;
+
+#define DEFAULT_QUERY_MEMORY_BUDGET (1024ull * 1024 * 1024)
+
+// Search counters; build with -DSEARCH_STATS=0 to compile them out.
+#ifndef SEARCH_STATS
+#define SEARCH_STATS 1
+#endif
+
+typedef struct
+{
+  u64 nodes_visited;       // Search steps, each ending at a new chain state.
+  u64 containment_checks;
+  u64 subtractions;        // Chain elements that fit.
+  u64 backtracks;
+  u64 results;
+  u32 max_chain_depth;
+
+  u64 collect_ns;
+  u64 search_ns;
+  u64 output_ns;
+} search_stats_t;
+
+// Timestamps for the counters are declared with stat_time_var, so that they
+// disappear along with them.
+#if SEARCH_STATS
+#define stat_add(stats, field, amount) ((stats)->field += (amount))
+#define stat_max(stats, field, value) ((stats)->field = max((stats)->field, (value)))
+#define stat_time_var(name) u64 name = get_nanoseconds()
+#else
+#define stat_add(stats, field, amount) ((void)0)
+#define stat_max(stats, field, value) ((void)0)
+#define stat_time_var(name)
+#endif
+
+// The clock is only read every so many search steps.
+#define DEADLINE_CHECK_INTERVAL 1024
+
+#define MAX_DICTIONARIES 32
+#define ALL_DICTIONARIES U32_MAX
+
 typedef struct
 {
   keylink_t* entries[128 * 1024];
+
+  u32 dictionary_count;
+  str_t dictionary_names[MAX_DICTIONARIES];
 } hashtable_t;
 
-internal breakdown_t breakdown_word(str_t word)
+#define ALPHABET_IGNORED 0xfe  // Not a letter, but allowed in words (punctuation, digits).
+#define ALPHABET_INVALID 0xff  // Not a letter; dictionary words containing it are skipped.
+#define ALPHABET_TABLE_SIZE 0x800  // Covers all two-byte UTF-8 sequences.
+#define MAX_ALPHABET_EXTRA_CODEPOINTS 64
+
+typedef struct
 {
-  breakdown_t result = {0};
+  u32 letter_count;
+  u32 letters[BREAKDOWN_WIDTH];  // Lowercase codepoint shown for each letter.
+  u32 breakdown_width;  // Counts the breakdown operations look at: 16, 32 or 64.
+  b32 ascii_only;
 
-  for(u32 idx = 0;
-      idx < word.size;
-      ++idx)
+  u8 letter_for_codepoint[ALPHABET_TABLE_SIZE];
+
+  u32 extra_count;
+  u32 extra_codepoints[MAX_ALPHABET_EXTRA_CODEPOINTS];
+  u8 extra_letters[MAX_ALPHABET_EXTRA_CODEPOINTS];
+} alphabet_t;
+
+// Groups are separated by spaces. The first character of a group is a letter,
+// the rest are variants folded onto it.
+struct
+{
+  char* name;
+  char* spec;
+} builtin_alphabets[] = {
+  { "en", "a b c d e f g h i j k l m n o p q r s t u v w x y z" },
+  { "latin",
+    "aàáâãäåāăą b cçćč dď eèéêëēėęě f gğ h iìíîïīį j k lłľĺ m nñńň oòóôõöøőō p q rřŕ "
+    "sśšşß tťţ uùúûüūůűų v w x yýÿ zźżž" },
+  { "de", "a b c d e f g h i j k l m n o p q r s t u v w x y z ä ö ü ß" },
+  { "es", "aá b c d eé f g h ií j k l m n ñ oó p q r s t uúü v w x y z" },
+  { "ru", "а б в г д её ж з и й к л м н о п р с т у ф х ц ч ш щ ъ ы ь э ю я" },
+};
+
+static alphabet_t global_alphabet;
+
+internal u32 alphabet_letter(alphabet_t* alphabet, u32 codepoint)
+{
+  u32 result = ALPHABET_INVALID;
+
+  if(codepoint < ALPHABET_TABLE_SIZE)
   {
-    u8 c = word.data[idx];
-    if(is_alpha(c))
+    result = alphabet->letter_for_codepoint[codepoint];
+  }
+  else
+  {
+    u32 lower = codepoint_to_lower(codepoint);
+    for(u32 extra_idx = 0;
+        extra_idx < alphabet->extra_count;
+        ++extra_idx)
     {
-      u32 breakdown_idx = to_lower(c) - 'a';
-      assert(breakdown_idx < array_count(result.counts));
-      assert(result.counts[breakdown_idx] < I8_MAX);
-      ++result.counts[breakdown_idx];
+      if(alphabet->extra_codepoints[extra_idx] == lower)
+      {
+        result = alphabet->extra_letters[extra_idx];
+        break;
+      }
     }
   }
 
   return result;
 }
 
-internal b32 breakdown_eq(breakdown_t* a, breakdown_t* b)
+// Accepts the name of a builtin alphabet or a spec in the same format.
+internal b32 set_alphabet(alphabet_t* alphabet, char* name_or_spec)
 {
-  b32 equal = true;
+  b32 valid = true;
+  char* spec = name_or_spec;
+  for(u32 builtin_idx = 0;
+      builtin_idx < array_count(builtin_alphabets);
+      ++builtin_idx)
+  {
+    if(zstr_eq(name_or_spec, builtin_alphabets[builtin_idx].name))
+    {
+      spec = builtin_alphabets[builtin_idx].spec;
+    }
+  }
 
-  for(u32 idx = 0;
-      idx < array_count(a->counts) && equal;
-      ++idx)
+  *alphabet = (alphabet_t){0};
+  alphabet->ascii_only = true;
+  u32 spec_codepoints[ALPHABET_TABLE_SIZE];
+  u8 spec_letters[ALPHABET_TABLE_SIZE];
+  u32 spec_count = 0;
+
+  str_t spec_str = wrap_str(spec);
+  u8* at = spec_str.data;
+  u8* end = spec_str.data + spec_str.size;
+  b32 group_start = true;
+  while(at < end && valid)
+  {
+    u32 codepoint = codepoint_to_lower(utf8_decode(&at, end));
+    if(codepoint == ' ')
+    {
+      group_start = true;
+    }
+    else if(spec_count < array_count(spec_codepoints))
+    {
+      if(group_start)
+      {
+        if(alphabet->letter_count < BREAKDOWN_WIDTH)
+        {
+          alphabet->letters[alphabet->letter_count++] = codepoint;
+        }
+        else
+        {
+          fprintf(stderr, "Alphabet has more than %d letters\n", BREAKDOWN_WIDTH);
+          valid = false;
+        }
+        group_start = false;
+      }
+      spec_codepoints[spec_count] = codepoint;
+      spec_letters[spec_count] = (u8)(alphabet->letter_count - 1);
+      ++spec_count;
+      alphabet->ascii_only &= (codepoint < 0x80);
+    }
+  }
+
+  for(u32 codepoint = 0;
+      codepoint < ALPHABET_TABLE_SIZE;
+      ++codepoint)
   {
-    equal = (a->counts[idx] == b->counts[idx]);
+    alphabet->letter_for_codepoint[codepoint] = (codepoint < 0x80) ? ALPHABET_IGNORED : ALPHABET_INVALID;
+  }
+  for(u32 codepoint = 0;
+      codepoint < ALPHABET_TABLE_SIZE;
+      ++codepoint)
+  {
+    u32 lower = codepoint_to_lower(codepoint);
+    for(u32 spec_idx = 0;
+        spec_idx < spec_count;
+        ++spec_idx)
+    {
+      if(spec_codepoints[spec_idx] == lower)
+      {
+        alphabet->letter_for_codepoint[codepoint] = spec_letters[spec_idx];
+        break;
+      }
+    }
+  }
+  for(u32 spec_idx = 0;
+      spec_idx < spec_count;
+      ++spec_idx)
+  {
+    if(spec_codepoints[spec_idx] >= ALPHABET_TABLE_SIZE &&
+        alphabet->extra_count < MAX_ALPHABET_EXTRA_CODEPOINTS)
+    {
+      alphabet->extra_codepoints[alphabet->extra_count] = spec_codepoints[spec_idx];
+      alphabet->extra_letters[alphabet->extra_count] = spec_letters[spec_idx];
+      ++alphabet->extra_count;
+    }
   }
 
-  return equal;
+  alphabet->breakdown_width = alphabet->letter_count <= 16 ? 16 : alphabet->letter_count <= 32 ? 32 : 64;
+  valid &= (alphabet->letter_count > 0);
+  return valid;
 }
 
-internal b32 breakdown_is_empty(breakdown_t* a)
+internal void print_letter(u32 letter_idx)
 {
-  b32 all_zero = true;
+  u8 utf8[4];
+  u32 length = utf8_encode(global_alphabet.letters[letter_idx], utf8);
+  printf("%.*s", (int)length, utf8);
+}
 
-  for(u32 idx = 0;
-      idx < array_count(a->counts) && all_zero;
-      ++idx)
+internal breakdown_t breakdown_word(str_t word)
+{
+  breakdown_t result = {0};
+  alphabet_t* alphabet = &global_alphabet;
+
+  u8* at = word.data;
+  u8* end = word.data + word.size;
+  while(at < end)
   {
-    all_zero = (a->counts[idx] == 0);
+    u32 codepoint = (*at < 0x80) ? *at++ : utf8_decode(&at, end);
+    u32 breakdown_idx = alphabet_letter(alphabet, codepoint);
+    if(breakdown_idx < array_count(result.counts))
+    {
+      assert(result.counts[breakdown_idx] < I8_MAX);
+      ++result.counts[breakdown_idx];
+    }
   }
 
-  return all_zero;
+  return result;
 }
 
-internal b32 breakdown_is_positive(breakdown_t* a)
+// Like breakdown_word, but fails for words with characters outside the alphabet
+// or (unless include_uppercase) uppercase letters.
+internal b32 breakdown_dictionary_word(str_t word, b32 include_uppercase, breakdown_t* breakdown)
 {
-  b32 underflowed = false;
-  b32 positive = false;
+  b32 valid = true;
+  *breakdown = (breakdown_t){0};
+  alphabet_t* alphabet = &global_alphabet;
 
-  for(u32 idx = 0;
-      idx < array_count(a->counts) && !underflowed;
-      ++idx)
+  u8* at = word.data;
+  u8* end = word.data + word.size;
+  while(at < end && valid)
   {
-    underflowed = (a->counts[idx] < 0);
-    positive |= (a->counts[idx] > 0);
+    u32 codepoint = utf8_decode(&at, end);
+    u32 breakdown_idx = alphabet_letter(alphabet, codepoint);
+    valid = (breakdown_idx != ALPHABET_INVALID) &&
+      (include_uppercase || codepoint_to_lower(codepoint) == codepoint);
+    if(valid && breakdown_idx < array_count(breakdown->counts))
+    {
+      valid = (breakdown->counts[breakdown_idx] < I8_MAX);
+      ++breakdown->counts[breakdown_idx];
+    }
   }
 
-  return !underflowed && positive;
+  return valid;
+}
+
+// Breakdowns are handled 8 counts at a time, as u64 lanes with one guard bit
+// (the sign bit) per count. Counts stay within -127..127.
+#define BREAKDOWN_LANE_SIGNS 0x8080808080808080ull
+#define PACKED_KEY_LOW_NIBBLES 0x0f0f0f0f0f0f0f0full
+#define PACKED_KEY_GUARDS      0x1010101010101010ull
+
+#define BREAKDOWN_OPS_WIDTH 16
+#include "breakdown_ops.h"
+#define BREAKDOWN_OPS_WIDTH 32
+#include "breakdown_ops.h"
+#if BREAKDOWN_WIDTH >= 64
+#define BREAKDOWN_OPS_WIDTH 64
+#include "breakdown_ops.h"
+#endif
+
+// Calls the variant for the current alphabet's breakdown width. The width
+// never changes after startup, so the branches are always predicted.
+#if BREAKDOWN_WIDTH >= 64
+#define breakdown_dispatch(name, ...) \
+  (global_alphabet.breakdown_width <= 16 ? name##_16(__VA_ARGS__) : \
+   global_alphabet.breakdown_width <= 32 ? name##_32(__VA_ARGS__) : name##_64(__VA_ARGS__))
+#else
+#define breakdown_dispatch(name, ...) \
+  (global_alphabet.breakdown_width <= 16 ? name##_16(__VA_ARGS__) : name##_32(__VA_ARGS__))
+#endif
+
+internal b32 breakdown_eq(breakdown_t* a, breakdown_t* b)
+{
+  return breakdown_dispatch(breakdown_eq, a, b);
+}
+
+internal b32 breakdown_is_empty(breakdown_t* a)
+{
+  return breakdown_dispatch(breakdown_is_empty, a);
 }
 
 internal b32 breakdown_underflowed(breakdown_t* a)
 {
-  b32 underflowed = false;
+  return breakdown_dispatch(breakdown_underflowed, a);
+}
+
+internal b32 breakdown_is_positive(breakdown_t* a)
+{
+  return !breakdown_underflowed(a) && !breakdown_is_empty(a);
+}
+
+// Both breakdowns must be non-negative.
+internal b32 breakdown_contains(breakdown_t* a, breakdown_t* b)
+{
+  return breakdown_dispatch(breakdown_contains, a, b);
+}
+
+internal void breakdown_add(breakdown_t* a, breakdown_t* b)
+{
+  breakdown_dispatch(breakdown_add, a, b);
+}
+
+// Returns false if any count went negative.
+internal b32 breakdown_subtract(breakdown_t* a, breakdown_t* b)
+{
+  return breakdown_dispatch(breakdown_subtract, a, b);
+}
+
+// Counts above PACKED_KEY_MAX_COUNT saturate, which keeps containment checks
+// exact as long as the contained key was not saturated.
+internal packed_key_t pack_breakdown(breakdown_t* breakdown)
+{
+  packed_key_t result = {0};
 
   for(u32 idx = 0;
-      idx < array_count(a->counts) && !underflowed;
+      idx < array_count(breakdown->counts);
       ++idx)
   {
-    underflowed = (a->counts[idx] < 0);
+    u64 count = (u64)max(0, min(PACKED_KEY_MAX_COUNT, breakdown->counts[idx]));
+    result.lanes[idx / 16] |= count << (4 * (idx % 16));
   }
 
-  return underflowed;
+  return result;
 }
 
-internal b32 breakdown_contains(breakdown_t* a, breakdown_t* b)
+internal breakdown_t unpack_key(packed_key_t* key)
 {
-  b32 contains = true;
+  breakdown_t result = {0};
 
   for(u32 idx = 0;
-      idx < array_count(a->counts) && contains;
+      idx < array_count(result.counts);
       ++idx)
   {
-    contains = (a->counts[idx] >= b->counts[idx]);
+    result.counts[idx] = (i8)((key->lanes[idx / 16] >> (4 * (idx % 16))) & 0xf);
   }
 
-  return contains;
+  return result;
+}
+
+internal b32 breakdown_fits_packed_key(breakdown_t* breakdown)
+{
+  return breakdown_dispatch(breakdown_fits_packed_key, breakdown);
 }
 
-internal void breakdown_add(breakdown_t* a, breakdown_t* b)
+internal b32 packed_key_eq(packed_key_t* a, packed_key_t* b)
+{
+  return breakdown_dispatch(packed_key_eq, a, b);
+}
+
+internal b32 packed_key_contains(packed_key_t* a, packed_key_t* b)
+{
+  return breakdown_dispatch(packed_key_contains, a, b);
+}
+
+internal i32 breakdown_sum(breakdown_t* a)
+{
+  return breakdown_dispatch(breakdown_sum, a);
+}
+
+internal void breakdown_max0(breakdown_t* a)
+{
+  breakdown_dispatch(breakdown_max0, a);
+}
+
+// Query letters '?' and '*' are wildcards (blank tiles) that stand in for any letter.
+internal i32 breakdown_wildcards(str_t word)
 {
+  i32 wildcards = 0;
+
   for(u32 idx = 0;
-      idx < array_count(a->counts);
+      idx < word.size;
       ++idx)
   {
-    i32 sum = (i32)a->counts[idx] + (i32)b->counts[idx];
-    assert(sum <= I8_MAX);
-    a->counts[idx] = (i8)sum;
+    u8 c = word.data[idx];
+    if((c == '?' || c == '*') && alphabet_letter(&global_alphabet, c) == ALPHABET_IGNORED)
+    {
+      ++wildcards;
+    }
   }
+
+  return wildcards;
 }
 
-internal b32 breakdown_subtract(breakdown_t* a, breakdown_t* b)
+// Sum of the negative counts, i.e. how many letters wildcards have to fill in.
+internal i32 breakdown_deficit(breakdown_t* a)
 {
-  b32 negative = false;
+  return breakdown_dispatch(breakdown_deficit, a);
+}
 
-  for(u32 idx = 0;
-      idx < array_count(a->counts);
-      ++idx)
-  {
-    i32 difference = (i32)a->counts[idx] - (i32)b->counts[idx];
-    assert(difference >= I8_MIN);
-    a->counts[idx] = (i8)difference;
+// Like breakdown_contains, but a may already be negative from earlier wildcard
+// use, and up to `wildcards` letters may be missing in total.
+internal b32 breakdown_contains_with_wildcards(breakdown_t* a, breakdown_t* b, i32 wildcards)
+{
+  b32 result;
 
-    negative = negative || (difference < 0);
+  if(wildcards == 0)
+  {
+    result = breakdown_contains(a, b);
+  }
+  else
+  {
+    breakdown_t difference = *a;
+    breakdown_subtract(&difference, b);
+    result = (breakdown_deficit(&difference) <= wildcards);
   }
 
-  return !negative;
+  return result;
 }
 
-internal i32 breakdown_sum(breakdown_t* a)
+// All letters used and every wildcard spent.
+internal b32 breakdown_is_complete(breakdown_t* a, i32 wildcards)
 {
-  i32 sum = 0;
+  b32 result;
 
-  for(u32 idx = 0;
-      idx < array_count(a->counts);
-      ++idx)
+  if(wildcards == 0)
+  {
+    result = breakdown_is_empty(a);
+  }
+  else
   {
-    sum += a->counts[idx];
+    result = (breakdown_deficit(a) == wildcards && breakdown_sum(a) == -wildcards);
   }
 
-  return sum;
+  return result;
 }
 
-internal void breakdown_max0(breakdown_t* a)
+internal b32 packed_key_contains_with_wildcards(packed_key_t* packed_input, breakdown_t* input,
+    packed_key_t* key, i32 wildcards)
 {
-  for(u32 idx = 0;
-      idx < array_count(a->counts);
-      ++idx)
+  b32 result = packed_key_contains(packed_input, key);
+
+  if(!result && wildcards > 0)
   {
-    a->counts[idx] = max(0, a->counts[idx]);;
+    breakdown_t unpacked = unpack_key(key);
+    result = breakdown_contains_with_wildcards(input, &unpacked, wildcards);
   }
+
+  return result;
 }
 
 internal void print_breakdown(breakdown_t* breakdown)
@@ -194,7 +582,7 @@ internal void print_breakdown(breakdown_t* breakdown)
         j < count;
         ++j)
     {
-      printf("%c", 'a' + idx);
+      print_letter(idx);
     }
   }
 }
@@ -215,14 +603,15 @@ internal u32 hash_breakdown(breakdown_t* breakdown)
 }
 
 internal void hashtable_add_word(
-    hashtable_t* hashtable, arena_t* arena, str_t word, breakdown_t* breakdown)
+    hashtable_t* hashtable, arena_t* arena, str_t word, breakdown_t* breakdown, u32 sources)
 {
   u32 hash = hash_breakdown(breakdown);
   u32 entry_idx = hash % array_count(hashtable->entries);
   keylink_t** hashtable_entry = hashtable->entries + entry_idx;
 
+  packed_key_t key = pack_breakdown(breakdown);
   keylink_t** same_key_entry = hashtable_entry;
-  while(*same_key_entry && !breakdown_eq(&(*same_key_entry)->key, breakdown))
+  while(*same_key_entry && !packed_key_eq(&(*same_key_entry)->key, &key))
   {
     same_key_entry = &(*same_key_entry)->next;
   }
@@ -230,210 +619,3248 @@ internal void hashtable_add_word(
   if(!*same_key_entry)
   {
     keylink_t* link = alloc_struct_clear(arena, keylink_t);
-    link->key = *breakdown;
+    link->key = key;
+    link->word_count = 1;
     link->first_word.word = word;
+    link->first_word.sources = sources;
     link->first_word.next = 0;
     link->next = *hashtable_entry;
     *hashtable_entry = link;
   }
   else
   {
-    // TODO: Only insert word if it hasn't appeared yet.
-    //       Iterate word links, abort if seen, append to end?
     keylink_t* link = *same_key_entry;
+    ++link->word_count;
     wordlink_t* new_word = alloc_struct(arena, wordlink_t);
     *new_word = link->first_word;
     link->first_word.word = word;
+    link->first_word.sources = sources;
     link->first_word.next = new_word;
   }
 }
 
-internal void list_anagram_groups(hashtable_t* hashtable, arena_t* arena, u32 min_word_count)
+typedef struct
 {
-  typedef struct anagram_group_t
-  {
-    u32 word_count;
-    keylink_t* keylink;
-    struct anagram_group_t* next;
-  } anagram_group_t;
-
-  anagram_group_t* groups = 0;
-  for(u32 entry_idx = 0;
-      entry_idx < array_count(hashtable->entries);
-      ++entry_idx)
-  {
-    for(keylink_t* keylink = hashtable->entries[entry_idx];
-        keylink;
-        keylink = keylink->next)
-    {
-      u32 word_count = 0;
-      for(wordlink_t* word_link = &keylink->first_word;
-          word_link;
-          word_link = word_link->next)
-      {
-        ++word_count;
-      }
+  str_t word;
+  u32 sources;
+} wordset_slot_t;
 
-      if(word_count >= min_word_count)
-      {
-        // Insert biggest groups first.
-        anagram_group_t** next_smallest_group = &groups;
-        while(*next_smallest_group && (*next_smallest_group)->word_count >= word_count)
-        {
-          next_smallest_group = &(*next_smallest_group)->next;
-        }
+typedef struct
+{
+  u32 capacity;  // Power of two.
+  u32 count;
+  b32 fold_case;
+  wordset_slot_t* slots;
+} wordset_t;
 
-        anagram_group_t* new_group = alloc_struct(arena, anagram_group_t);
-        new_group->word_count = word_count;
-        new_group->keylink = keylink;
-        new_group->next = *next_smallest_group;
-        *next_smallest_group = new_group;
-      }
-    }
+internal wordset_t new_wordset(arena_t* arena, u32 expected_count, b32 fold_case)
+{
+  wordset_t result = {0};
+  result.capacity = 64;
+  while(result.capacity < 2 * expected_count)
+  {
+    result.capacity *= 2;
   }
+  result.fold_case = fold_case;
+  result.slots = alloc_array_clear(arena, result.capacity, wordset_slot_t);
+  return result;
+}
 
-  for(anagram_group_t* group = groups;
-      group;
-      group = group->next)
+internal u32 hash_word(str_t word, b32 fold_case)
+{
+  // FNV-1a, over bytes or, with fold_case, over lowercased codepoints.
+  u32 result = 2166136261u;
+
+  u8* end = word.data + word.size;
+  for(u8* at = word.data;
+      at < end;)
   {
-    printf("\n");
-    for(wordlink_t* word_link = &group->keylink->first_word;
-        word_link;
-        word_link = word_link->next)
-    {
-      str_t word = word_link->word;
-      printf("%.*s\n", (int)word.size, word.data);
-    }
+    u32 c = fold_case ? codepoint_to_lower(utf8_decode(&at, end)) : *at++;
+    result = (result ^ c) * 16777619u;
   }
+
+  return result;
 }
 
-internal void list_anagrams_for(hashtable_t* hashtable, arena_t* arena,
-    breakdown_t input_breakdown, str_t must_include, str_t space_separated_must_exclude,
-    i32 max_results)
+// Returns the slot of the word (or, with fold_case, of a case variant of it),
+// inserting it if needed. Returns 0 if the set is full.
+internal wordset_slot_t* wordset_insert(wordset_t* set, str_t word, b32* inserted)
 {
-  breakdown_t reduced_input_breakdown = input_breakdown;
-  breakdown_t must_include_breakdown = breakdown_word(must_include);
-  b32 must_include_is_valid = breakdown_subtract(&reduced_input_breakdown, &must_include_breakdown);
+  wordset_slot_t* result = 0;
+  *inserted = false;
 
-  if(!must_include_is_valid)
+  u32 mask = set->capacity - 1;
+  u32 slot_idx = hash_word(word, set->fold_case) & mask;
+  while(set->slots[slot_idx].word.data && !result)
   {
-    breakdown_t missing_letters = must_include_breakdown;
-    breakdown_subtract(&missing_letters, &input_breakdown);
-    breakdown_max0(&missing_letters);
-    printf("Missing %d letters:\n", breakdown_sum(&missing_letters));
-    for(u32 breakdown_idx = 0;
-        breakdown_idx < array_count(missing_letters.counts);
-        ++breakdown_idx)
+    str_t slot_word = set->slots[slot_idx].word;
+    if(set->fold_case ? str_eq_nocase(slot_word, word) : str_eq(slot_word, word))
     {
-      i8 count = missing_letters.counts[breakdown_idx];
-      if(count != 0)
-      {
-        printf("  %dx '%c'\n", (int)count, 'a' + breakdown_idx);
-      }
+      result = set->slots + slot_idx;
     }
-
-    printf("\nPossible additions:\n");
-    list_anagrams_for(hashtable, arena, missing_letters, str(""), str(""), 20);
+    slot_idx = (slot_idx + 1) & mask;
   }
-  else if(breakdown_is_empty(&reduced_input_breakdown))
+
+  if(!result && set->count < set->capacity / 2)
   {
-    printf("  %.*s\n", (int)must_include.size, must_include.data);
+    result = set->slots + slot_idx;
+    result->word = word;
+    ++set->count;
+    *inserted = true;
   }
-  else
-  {
-    wordlink_t* excluded_words = 0;
 
-    // Separate excluded words by space.
-    for(i32 idx = 0, last_wordstart = 0;
-        idx <= space_separated_must_exclude.size;
-        ++idx)
-    {
-      if(idx == space_separated_must_exclude.size ||
-          space_separated_must_exclude.data[idx] == ' ')
-      {
-        i32 size = idx - last_wordstart;
-        if(size > 0)
-        {
-          str_t word = {
-            .size = (u32)size,
-            .data = space_separated_must_exclude.data + last_wordstart,
-          };
-          wordlink_t* new_excluded_word = alloc_struct(arena, wordlink_t);
-          new_excluded_word->word = word;
-          new_excluded_word->next = excluded_words;
-          excluded_words = new_excluded_word;
-        }
-        last_wordstart = idx + 1;
-      }
-    }
+  return result;
+}
 
-    // Find words that could fit into the input.
-    keylink_t* subkeys = 0;
-    for(u32 entry_idx = 0;
+typedef struct
+{
+  str_t word;
+  breakdown_t breakdown;
+  u32 entry_idx;
+  u32 next_in_partition;
+} parsed_word_t;
+
+#define MAX_THREADS 16
+#define NO_PARSED_WORD U32_MAX
+
+typedef struct
+{
+  str_t text;
+  u32 sources;
+  b32 include_uppercase;
+  u32 partition_count;
+
+  arena_t arena;
+  u32 word_count;
+  u32 skipped_word_count;  // Too many of a letter to store.
+  parsed_word_t* words;
+  u32 partition_word_counts[MAX_THREADS];
+  u32 partition_first[MAX_THREADS];
+  u32 partition_last[MAX_THREADS];
+} load_chunk_t;
+
+typedef struct
+{
+  hashtable_t* hashtable;
+  load_chunk_t* chunks;
+  u32 chunk_count;
+  u32 partition_idx;
+  u32 partition_count;
+  b32 fold_case;
+
+  arena_t* key_arena;
+} load_partition_t;
+
+typedef struct
+{
+  str_t name;
+  str_t text;
+} dictionary_source_t;
+
+// Classifies up to 16 bytes: bit i of *breaks is set for line breaks,
+// bit i of *rejects for ASCII uppercase letters (unless include_uppercase),
+// bit i of *non_ascii for bytes of multi-byte characters.
+internal void classify_dictionary_bytes(u8* bytes, u32 count, b32 include_uppercase,
+    u32* breaks, u32* rejects, u32* non_ascii)
+{
+  assert(count <= 16);
+#ifdef __SSE2__
+  if(count == 16)
+  {
+    __m128i v = _mm_loadu_si128((__m128i*)bytes);
+    __m128i bias = _mm_set1_epi8((char)0x80);
+    // Unsigned range checks, done as signed compares on biased values.
+    __m128i from_linebreak = _mm_xor_si128(_mm_sub_epi8(v, _mm_set1_epi8('\n')), bias);
+    __m128i is_break = _mm_cmplt_epi8(from_linebreak, _mm_set1_epi8((char)(0x80 + 4)));
+    *breaks = (u32)_mm_movemask_epi8(is_break);
+    *non_ascii = (u32)_mm_movemask_epi8(v);
+    *rejects = 0;
+    if(!include_uppercase)
+    {
+      __m128i from_upper = _mm_xor_si128(_mm_sub_epi8(v, _mm_set1_epi8('A')), bias);
+      __m128i is_upper_v = _mm_cmplt_epi8(from_upper, _mm_set1_epi8((char)(0x80 + 26)));
+      *rejects |= (u32)_mm_movemask_epi8(is_upper_v);
+    }
+  }
+  else
+#endif
+  {
+    *breaks = 0;
+    *rejects = 0;
+    *non_ascii = 0;
+    for(u32 idx = 0;
+        idx < count;
+        ++idx)
+    {
+      u8 c = bytes[idx];
+      if(is_linebreak(c))
+      {
+        *breaks |= (1u << idx);
+      }
+      else if(!is_ascii(c))
+      {
+        *non_ascii |= (1u << idx);
+      }
+      else if(!include_uppercase && is_upper(c))
+      {
+        *rejects |= (1u << idx);
+      }
+    }
+  }
+}
+
+// Buckets are split into contiguous ranges, one per partition.
+internal u32 hash_entry_partition(u32 entry_idx, u32 partition_count)
+{
+  return (u32)(((u64)entry_idx * partition_count) / array_count(((hashtable_t*)0)->entries));
+}
+
+internal void add_parsed_word(load_chunk_t* chunk, str_t word, b32 has_non_ascii)
+{
+  breakdown_t breakdown = {0};
+  b32 valid = true;
+  if(has_non_ascii)
+  {
+    valid = breakdown_dictionary_word(word, chunk->include_uppercase, &breakdown);
+  }
+  else
+  {
+    // ASCII words were already checked while classifying.
+    breakdown = breakdown_word(word);
+  }
+
+  if(valid && breakdown_sum(&breakdown) > 0 && !breakdown_fits_packed_key(&breakdown))
+  {
+    ++chunk->skipped_word_count;
+  }
+  else if(valid && breakdown_sum(&breakdown) > 0)
+  {
+    u32 word_idx = chunk->word_count++;
+    parsed_word_t* parsed = chunk->words + word_idx;
+    parsed->word = word;
+    parsed->breakdown = breakdown;
+    parsed->entry_idx = hash_breakdown(&breakdown) % array_count(((hashtable_t*)0)->entries);
+    parsed->next_in_partition = NO_PARSED_WORD;
+
+    u32 partition_idx = hash_entry_partition(parsed->entry_idx, chunk->partition_count);
+    if(chunk->partition_word_counts[partition_idx]++ == 0)
+    {
+      chunk->partition_first[partition_idx] = word_idx;
+    }
+    else
+    {
+      chunk->words[chunk->partition_last[partition_idx]].next_in_partition = word_idx;
+    }
+    chunk->partition_last[partition_idx] = word_idx;
+  }
+}
+
+internal void* parse_dictionary_chunk(void* data)
+{
+  u64 trace_start = trace_begin();
+  load_chunk_t* chunk = (load_chunk_t*)data;
+  u8* text = chunk->text.data;
+  u32 size = (u32)chunk->text.size;
+
+  u32 line_count = 1;
+  for(u32 idx = 0;
+      idx < size;
+      ++idx)
+  {
+    line_count += is_linebreak(text[idx]);
+  }
+  chunk->words = alloc_array(&chunk->arena, line_count, parsed_word_t);
+
+  // Only alphabets with non-ASCII letters need to look at multi-byte characters.
+  b32 reject_non_ascii = global_alphabet.ascii_only;
+
+  u32 word_start = 0;
+  b32 word_valid = true;
+  b32 word_has_non_ascii = false;
+  for(u32 block_start = 0;
+      block_start < size;
+      block_start += 16)
+  {
+    u32 block_size = min(16, size - block_start);
+    u32 breaks, rejects, non_ascii;
+    classify_dictionary_bytes(text + block_start, block_size, chunk->include_uppercase,
+        &breaks, &rejects, &non_ascii);
+    if(reject_non_ascii)
+    {
+      rejects |= non_ascii;
+    }
+
+    while(breaks)
+    {
+      u32 break_bit = (u32)__builtin_ctz(breaks);
+      u32 before_break = (1u << break_bit) - 1;
+      word_valid = word_valid && !(rejects & before_break);
+      word_has_non_ascii = word_has_non_ascii || (non_ascii & before_break);
+
+      u32 word_end = block_start + break_bit;
+      if(word_valid)
+      {
+        add_parsed_word(chunk, (str_t){word_end - word_start, text + word_start},
+            word_has_non_ascii);
+      }
+      word_valid = true;
+      word_has_non_ascii = false;
+      word_start = word_end + 1;
+
+      rejects &= ~(before_break | (1u << break_bit));
+      non_ascii &= ~(before_break | (1u << break_bit));
+      breaks &= breaks - 1;
+    }
+    word_valid = word_valid && !rejects;
+    word_has_non_ascii = word_has_non_ascii || non_ascii;
+  }
+
+  if(word_valid && word_start < size)
+  {
+    add_parsed_word(chunk, (str_t){size - word_start, text + word_start}, word_has_non_ascii);
+  }
+
+  trace_end(trace_start, "parse_dictionary_chunk");
+  return 0;
+}
+
+internal void* build_hashtable_partition(void* data)
+{
+  u64 trace_start = trace_begin();
+  load_partition_t* partition = (load_partition_t*)data;
+  u32 partition_idx = partition->partition_idx;
+
+  u32 word_count = 0;
+  for(u32 chunk_idx = 0;
+      chunk_idx < partition->chunk_count;
+      ++chunk_idx)
+  {
+    word_count += partition->chunks[chunk_idx].partition_word_counts[partition_idx];
+  }
+
+  // Equal words have equal keys, so duplicates always land in the same partition.
+  arena_t wordset_arena = new_arena();
+  wordset_t seen_words = new_wordset(&wordset_arena, word_count, partition->fold_case);
+  b32 any_merged = false;
+
+  // Walk chunks in file order, so the table ends up the same as with a serial load.
+  for(u32 chunk_idx = 0;
+      chunk_idx < partition->chunk_count;
+      ++chunk_idx)
+  {
+    load_chunk_t* chunk = partition->chunks + chunk_idx;
+    if(chunk->partition_word_counts[partition_idx] > 0)
+    {
+      for(u32 word_idx = chunk->partition_first[partition_idx];
+          word_idx != NO_PARSED_WORD;
+          word_idx = chunk->words[word_idx].next_in_partition)
+      {
+        parsed_word_t* parsed = chunk->words + word_idx;
+        b32 inserted = false;
+        wordset_slot_t* slot = wordset_insert(&seen_words, parsed->word, &inserted);
+        if(inserted || !slot)
+        {
+          hashtable_add_word(partition->hashtable, partition->key_arena,
+              parsed->word, &parsed->breakdown, chunk->sources);
+        }
+        if(slot)
+        {
+          any_merged |= !inserted && !(slot->sources & chunk->sources);
+          slot->sources |= chunk->sources;
+        }
+      }
+    }
+  }
+
+  if(any_merged)
+  {
+    // Tag words that also appeared in later dictionaries.
+    hashtable_t* hashtable = partition->hashtable;
+    for(u32 entry_idx = 0;
         entry_idx < array_count(hashtable->entries);
         ++entry_idx)
     {
       for(keylink_t* key_link = hashtable->entries[entry_idx];
-          key_link;
+          key_link && hash_entry_partition(entry_idx, partition->partition_count) == partition_idx;
           key_link = key_link->next)
       {
-        if(breakdown_contains(&reduced_input_breakdown, &key_link->key))
+        for(wordlink_t* word_link = &key_link->first_word;
+            word_link;
+            word_link = word_link->next)
         {
-          wordlink_t* current_wordlink = 0;
+          b32 inserted = false;
+          wordset_slot_t* slot = wordset_insert(&seen_words, word_link->word, &inserted);
+          assert(slot && !inserted);
+          word_link->sources = slot->sources;
+        }
+      }
+    }
+  }
 
-          for(wordlink_t* test_wordlink = &key_link->first_word;
-              test_wordlink;
-              test_wordlink = test_wordlink->next)
-          {
-            str_t word = test_wordlink->word;
+  clear_arena(&wordset_arena);
+  trace_end(trace_start, "build_hashtable_partition");
+  return 0;
+}
 
-            b32 excluded = false;
-            for(wordlink_t* excluded_word = excluded_words;
-                excluded_word && !excluded;
-                excluded_word = excluded_word->next)
-            {
-              if(str_eq(word, excluded_word->word))
-              {
-                excluded = true;
-              }
-            }
+typedef struct
+{
+  void* (*fun)(void*);
+  u8* jobs;
+  size_t job_size;
+  u32 job_count;
+  u32 next_job_idx;
+} job_queue_t;
+
+internal void* run_queued_jobs(void* data)
+{
+  job_queue_t* queue = (job_queue_t*)data;
+  for(;;)
+  {
+    u32 job_idx = __atomic_fetch_add(&queue->next_job_idx, 1, __ATOMIC_RELAXED);
+    if(job_idx >= queue->job_count) { break; }
+    queue->fun(queue->jobs + job_idx * queue->job_size);
+  }
+  return 0;
+}
 
-            if(!excluded)
-            {
-              if(!current_wordlink)
-              {
-                // Insert longest words first.
-                u32 key_sum = breakdown_sum(&key_link->key);
-                keylink_t** subkey = &subkeys;
-                while(*subkey && breakdown_sum(&(*subkey)->key) >= key_sum)
-                {
-                  subkey = &(*subkey)->next;
-                }
+internal void run_in_threads(void* (*fun)(void*), void* jobs, size_t job_size, u32 job_count,
+    u32 thread_count)
+{
+  job_queue_t queue = {fun, (u8*)jobs, job_size, job_count, 0};
+  pthread_t threads[MAX_THREADS];
+  thread_count = max(1, min(min(job_count, thread_count), array_count(threads)));
+
+  // Threads that fail to start are left out; this thread drains the queue anyway.
+  u32 started_count = 1;
+  for(u32 thread_idx = 1;
+      thread_idx < thread_count;
+      ++thread_idx)
+  {
+    if(pthread_create(&threads[started_count], 0, run_queued_jobs, &queue) == 0)
+    {
+      ++started_count;
+    }
+  }
 
-                keylink_t* new_subkey = alloc_struct(arena, keylink_t);
-                new_subkey->key = key_link->key;
-                new_subkey->next = *subkey;
-                *subkey = new_subkey;
-                current_wordlink = &new_subkey->first_word;
-              }
-              else
-              {
-                wordlink_t* new_word = alloc_struct(arena, wordlink_t);
-                current_wordlink->next = new_word;
-                current_wordlink = new_word;
-              }
+  run_queued_jobs(&queue);
 
-              current_wordlink->word = word;
-              current_wordlink->next = 0;
-            }
+  for(u32 thread_idx = 1;
+      thread_idx < started_count;
+      ++thread_idx)
+  {
+    pthread_join(threads[thread_idx], 0);
+  }
+}
+
+internal u32 default_thread_count()
+{
+  i64 cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  return (u32)max(1, min(MAX_THREADS, cpu_count));
+}
+
+internal u32 default_load_thread_count(size_t text_size)
+{
+  u32 result = default_thread_count();
+  // Not worth spawning threads for less than 256K of text each.
+  result = (u32)max(1, min(result, text_size / (256 * 1024)));
+  return result;
+}
+
+// Words in the table point into the source texts, which must outlive the table.
+// Each source's words are tagged with bit (1 << source index).
+internal void load_dictionary(hashtable_t* hashtable, arena_t* arena,
+    dictionary_source_t* sources, u32 source_count,
+    b32 include_uppercase, b32 fold_case, u32 thread_count)
+{
+  u64 trace_start = trace_begin();
+  thread_count = max(1, min(MAX_THREADS, thread_count));
+  source_count = min(MAX_DICTIONARIES, source_count);
+
+  // Split the texts into chunks at line breaks.
+  load_chunk_t* chunks = alloc_array_clear(arena, source_count * thread_count, load_chunk_t);
+  u32 chunk_count = 0;
+  for(u32 source_idx = 0;
+      source_idx < source_count;
+      ++source_idx)
+  {
+    str_t text = sources[source_idx].text;
+    hashtable->dictionary_names[hashtable->dictionary_count++] = sources[source_idx].name;
+
+    size_t chunk_start = 0;
+    for(u32 thread_idx = 0;
+        thread_idx < thread_count && chunk_start < text.size;
+        ++thread_idx)
+    {
+      size_t chunk_end = (text.size * (thread_idx + 1)) / thread_count;
+      while(chunk_end < text.size && !is_linebreak(text.data[chunk_end]))
+      {
+        ++chunk_end;
+      }
+      chunk_end = min(text.size, chunk_end + 1);
+
+      load_chunk_t* chunk = chunks + chunk_count++;
+      chunk->text = (str_t){chunk_end - chunk_start, text.data + chunk_start};
+      chunk->sources = 1u << source_idx;
+      chunk->include_uppercase = include_uppercase;
+      chunk->partition_count = thread_count;
+      chunk->arena = new_arena();
+
+      chunk_start = chunk_end;
+    }
+  }
+
+  run_in_threads(parse_dictionary_chunk, chunks, sizeof(load_chunk_t), chunk_count, thread_count);
+
+  load_partition_t* partitions = alloc_array_clear(arena, thread_count, load_partition_t);
+  for(u32 partition_idx = 0;
+      partition_idx < thread_count;
+      ++partition_idx)
+  {
+    load_partition_t* partition = partitions + partition_idx;
+    partition->hashtable = hashtable;
+    partition->chunks = chunks;
+    partition->chunk_count = chunk_count;
+    partition->partition_idx = partition_idx;
+    partition->partition_count = thread_count;
+    partition->fold_case = fold_case;
+
+    // Keys stay alive as long as the table does.
+    partition->key_arena = alloc_struct(arena, arena_t);
+    *partition->key_arena = new_huge_page_arena();
+  }
+
+  run_in_threads(build_hashtable_partition, partitions, sizeof(load_partition_t), thread_count,
+      thread_count);
+
+  u32 skipped_word_count = 0;
+  for(u32 chunk_idx = 0;
+      chunk_idx < chunk_count;
+      ++chunk_idx)
+  {
+    skipped_word_count += chunks[chunk_idx].skipped_word_count;
+    clear_arena(&chunks[chunk_idx].arena);
+  }
+  if(skipped_word_count)
+  {
+    fprintf(stderr, "Skipped %u word%s with more than %d of a letter\n",
+        skipped_word_count, skipped_word_count == 1 ? "" : "s", PACKED_KEY_MAX_COUNT);
+  }
+  trace_end(trace_start, "load_dictionary");
+}
+
+typedef struct
+{
+  hashtable_t* hashtable;
+  u32 first_entry_idx;
+  u32 end_entry_idx;
+  u32 min_word_count;
+  u32 enabled_dictionaries;
+
+  arena_t arena;
+  u32 group_count;
+  keylink_t** groups;
+  u32* group_word_counts;
+  u32 max_word_count;
+} group_scan_t;
+
+internal u32 count_enabled_words(keylink_t* keylink, u32 enabled_dictionaries)
+{
+  u32 word_count = keylink->word_count;
+
+  if(enabled_dictionaries != ALL_DICTIONARIES)
+  {
+    word_count = 0;
+    for(wordlink_t* word_link = &keylink->first_word;
+        word_link;
+        word_link = word_link->next)
+    {
+      word_count += !!(word_link->sources & enabled_dictionaries);
+    }
+  }
+
+  return word_count;
+}
+
+internal void* scan_anagram_groups(void* data)
+{
+  group_scan_t* scan = (group_scan_t*)data;
+  hashtable_t* hashtable = scan->hashtable;
+
+  // Count first, then collect into exactly sized arrays.
+  for(u32 pass = 0;
+      pass < 2;
+      ++pass)
+  {
+    if(pass == 1)
+    {
+      scan->groups = alloc_array(&scan->arena, scan->group_count, keylink_t*);
+      scan->group_word_counts = alloc_array(&scan->arena, scan->group_count, u32);
+      scan->group_count = 0;
+    }
+
+    for(u32 entry_idx = scan->first_entry_idx;
+        entry_idx < scan->end_entry_idx;
+        ++entry_idx)
+    {
+      for(keylink_t* keylink = hashtable->entries[entry_idx];
+          keylink;
+          keylink = keylink->next)
+      {
+        u32 word_count = count_enabled_words(keylink, scan->enabled_dictionaries);
+        if(word_count >= scan->min_word_count)
+        {
+          if(pass == 1)
+          {
+            scan->groups[scan->group_count] = keylink;
+            scan->group_word_counts[scan->group_count] = word_count;
+            scan->max_word_count = max(scan->max_word_count, word_count);
           }
+          ++scan->group_count;
         }
       }
     }
+  }
+
+  return 0;
+}
+
+internal void list_anagram_groups(hashtable_t* hashtable, arena_t* arena, u32 min_word_count,
+    u32 enabled_dictionaries)
+{
+  min_word_count = max(1, min_word_count);
+
+  u32 scan_count = default_thread_count();
+  group_scan_t* scans = alloc_array_clear(arena, scan_count, group_scan_t);
+  u32 entry_count = array_count(hashtable->entries);
+  for(u32 scan_idx = 0;
+      scan_idx < scan_count;
+      ++scan_idx)
+  {
+    group_scan_t* scan = scans + scan_idx;
+    scan->hashtable = hashtable;
+    scan->first_entry_idx = (u32)(((u64)entry_count * scan_idx) / scan_count);
+    scan->end_entry_idx = (u32)(((u64)entry_count * (scan_idx + 1)) / scan_count);
+    scan->min_word_count = min_word_count;
+    scan->enabled_dictionaries = enabled_dictionaries;
+    scan->arena = new_arena();
+  }
+
+  run_in_threads(scan_anagram_groups, scans, sizeof(group_scan_t), scan_count, scan_count);
+
+  // Counting sort by word count, biggest groups first.
+  // Equal sizes keep the order of the table scan.
+  u32 max_word_count = 0;
+  u32 group_count = 0;
+  for(u32 scan_idx = 0;
+      scan_idx < scan_count;
+      ++scan_idx)
+  {
+    max_word_count = max(max_word_count, scans[scan_idx].max_word_count);
+    group_count += scans[scan_idx].group_count;
+  }
+
+  u32* size_starts = alloc_array_clear(arena, max_word_count + 2, u32);
+  for(u32 scan_idx = 0;
+      scan_idx < scan_count;
+      ++scan_idx)
+  {
+    for(u32 group_idx = 0;
+        group_idx < scans[scan_idx].group_count;
+        ++group_idx)
+    {
+      ++size_starts[max_word_count - scans[scan_idx].group_word_counts[group_idx] + 1];
+    }
+  }
+  for(u32 size_idx = 0;
+      size_idx <= max_word_count;
+      ++size_idx)
+  {
+    size_starts[size_idx + 1] += size_starts[size_idx];
+  }
+
+  keylink_t** sorted_groups = alloc_array(arena, group_count, keylink_t*);
+  for(u32 scan_idx = 0;
+      scan_idx < scan_count;
+      ++scan_idx)
+  {
+    for(u32 group_idx = 0;
+        group_idx < scans[scan_idx].group_count;
+        ++group_idx)
+    {
+      u32 size_idx = max_word_count - scans[scan_idx].group_word_counts[group_idx];
+      sorted_groups[size_starts[size_idx]++] = scans[scan_idx].groups[group_idx];
+    }
+  }
+
+  out_buf_t* out = alloc_struct(arena, out_buf_t);
+  *out = (out_buf_t){ .file = stdout };
+  for(u32 group_idx = 0;
+      group_idx < group_count;
+      ++group_idx)
+  {
+    out_char(out, '\n');
+    for(wordlink_t* word_link = &sorted_groups[group_idx]->first_word;
+        word_link;
+        word_link = word_link->next)
+    {
+      if(word_link->sources & enabled_dictionaries)
+      {
+        out_str(out, word_link->word);
+        out_char(out, '\n');
+      }
+    }
+  }
+  out_flush(out);
+
+  for(u32 scan_idx = 0;
+      scan_idx < scan_count;
+      ++scan_idx)
+  {
+    clear_arena(&scans[scan_idx].arena);
+  }
+}
+
+// Perfect hash over all keys, for looking up single-word anagrams.
+// Keys are spread over buckets of a few keys each; every bucket gets a pilot
+// value that moves all of its keys to free slots. A lookup then touches the
+// (small) pilot array and exactly one slot. If some bucket finds no pilot,
+// the index is built again with another hash seed and more slots.
+#define EXACT_INDEX_MAX_PILOT (1u << 16)
+#define EXACT_INDEX_MAX_ATTEMPTS 8
+
+typedef struct
+{
+  packed_key_t key;
+  keylink_t* keylink;
+} exact_slot_t;
+
+typedef struct
+{
+  u64 seed;
+  u32 slot_count;
+  u32 bucket_count;
+  u32* pilots;
+  exact_slot_t* slots;
+} exact_index_t;
+
+internal u64 mix64(u64 x)
+{
+  // splitmix64 finalizer.
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+internal u64 hash_packed_key(packed_key_t* key)
+{
+  u64 result = 0;
+
+  for(u32 lane = 0;
+      lane < array_count(key->lanes);
+      ++lane)
+  {
+    result = mix64(result ^ key->lanes[lane]);
+  }
+
+  return result;
+}
+
+internal u64 hash_exact_key(exact_index_t* index, packed_key_t* key)
+{
+  u64 result = index->seed;
+
+  for(u32 lane = 0;
+      lane < array_count(key->lanes);
+      ++lane)
+  {
+    result = mix64(result ^ key->lanes[lane]);
+  }
+
+  return result;
+}
+
+internal u32 exact_slot_idx(exact_index_t* index, u64 hash, u32 pilot)
+{
+  return (u32)(mix64(hash ^ (pilot * 0x9e3779b97f4a7c15ull)) % index->slot_count);
+}
+
+internal u32 exact_bucket_idx(exact_index_t* index, u64 hash)
+{
+  return (u32)((hash >> 32) % index->bucket_count);
+}
+
+// Returns false if a bucket found no pilot, or out of memory.
+internal b32 place_exact_keys(exact_index_t* index, hashtable_t* hashtable, arena_t* arena,
+    u32 key_count)
+{
+  index->pilots = alloc_array_clear(arena, index->bucket_count, u32);
+  index->slots = alloc_array_clear(arena, index->slot_count, exact_slot_t);
+
+  arena_snap_t snap = arena_snap(arena);
+
+  // Group keys by bucket, as index ranges into one array.
+  u32* bucket_starts = alloc_array_clear(arena, index->bucket_count + 1, u32);
+  u32* bucket_fill = alloc_array_clear(arena, index->bucket_count, u32);
+  u64* hashes = alloc_array(arena, key_count, u64);
+  keylink_t** bucket_keys = alloc_array(arena, key_count, keylink_t*);
+  u32* slot_taken_by = alloc_array_clear(arena, index->slot_count, u32);
+  b32 complete = (index->pilots && index->slots && bucket_starts && bucket_fill &&
+      ((hashes && bucket_keys) || key_count == 0) && slot_taken_by);
+  u32 max_bucket_size = 0;
+  if(complete)
+  {
+    for(u32 entry_idx = 0;
+        entry_idx < array_count(hashtable->entries);
+        ++entry_idx)
+    {
+      for(keylink_t* key_link = hashtable->entries[entry_idx];
+          key_link;
+          key_link = key_link->next)
+      {
+        ++bucket_starts[exact_bucket_idx(index, hash_exact_key(index, &key_link->key)) + 1];
+      }
+    }
+    for(u32 bucket_idx = 0;
+        bucket_idx < index->bucket_count;
+        ++bucket_idx)
+    {
+      max_bucket_size = max(max_bucket_size, bucket_starts[bucket_idx + 1]);
+      bucket_starts[bucket_idx + 1] += bucket_starts[bucket_idx];
+    }
+    for(u32 entry_idx = 0;
+        entry_idx < array_count(hashtable->entries);
+        ++entry_idx)
+    {
+      for(keylink_t* key_link = hashtable->entries[entry_idx];
+          key_link;
+          key_link = key_link->next)
+      {
+        u64 hash = hash_exact_key(index, &key_link->key);
+        u32 bucket_idx = exact_bucket_idx(index, hash);
+        u32 key_idx = bucket_starts[bucket_idx] + bucket_fill[bucket_idx]++;
+        hashes[key_idx] = hash;
+        bucket_keys[key_idx] = key_link;
+      }
+    }
+  }
+
+  // Place the biggest buckets first, while there is most room.
+  u32* tried_slots = alloc_array(arena, max(1, max_bucket_size), u32);
+  complete = complete && tried_slots;
+  for(u32 bucket_size = max_bucket_size;
+      bucket_size > 0 && complete;
+      --bucket_size)
+  {
+    for(u32 bucket_idx = 0;
+        bucket_idx < index->bucket_count && complete;
+        ++bucket_idx)
+    {
+      u32 start = bucket_starts[bucket_idx];
+      if(bucket_starts[bucket_idx + 1] - start == bucket_size)
+      {
+        b32 placed = false;
+        for(u32 pilot = 0;
+            !placed && pilot < EXACT_INDEX_MAX_PILOT;
+            ++pilot)
+        {
+          placed = true;
+          for(u32 key_idx = 0;
+              key_idx < bucket_size && placed;
+              ++key_idx)
+          {
+            u32 slot_idx = exact_slot_idx(index, hashes[start + key_idx], pilot);
+            tried_slots[key_idx] = slot_idx;
+            placed = !slot_taken_by[slot_idx];
+            for(u32 other_idx = 0;
+                other_idx < key_idx && placed;
+                ++other_idx)
+            {
+              placed = (tried_slots[other_idx] != slot_idx);
+            }
+          }
+
+          if(placed)
+          {
+            index->pilots[bucket_idx] = pilot;
+            for(u32 key_idx = 0;
+                key_idx < bucket_size;
+                ++key_idx)
+            {
+              exact_slot_t* slot = index->slots + tried_slots[key_idx];
+              slot_taken_by[tried_slots[key_idx]] = bucket_idx + 1;
+              slot->key = bucket_keys[start + key_idx]->key;
+              slot->keylink = bucket_keys[start + key_idx];
+            }
+          }
+        }
+        complete = placed;
+      }
+    }
+  }
+
+  arena_restore(snap);
+  return complete;
+}
+
+// Returns an index without slots if it could not be built.
+internal exact_index_t build_exact_index(hashtable_t* hashtable, arena_t* arena)
+{
+  exact_index_t index = {0};
+
+  u32 key_count = 0;
+  for(u32 entry_idx = 0;
+      entry_idx < array_count(hashtable->entries);
+      ++entry_idx)
+  {
+    for(keylink_t* key_link = hashtable->entries[entry_idx];
+        key_link;
+        key_link = key_link->next)
+    {
+      ++key_count;
+    }
+  }
+
+  b32 built = false;
+  for(u32 attempt = 0;
+      attempt < EXACT_INDEX_MAX_ATTEMPTS && !built;
+      ++attempt)
+  {
+    arena_snap_t snap = arena_snap(arena);
+    index.seed = mix64(attempt);
+    index.slot_count = max(1, key_count + (key_count / 8) * (attempt + 1));
+    index.bucket_count = max(1, key_count / 4);
+    built = place_exact_keys(&index, hashtable, arena, key_count);
+    if(!built)
+    {
+      arena_restore(snap);
+    }
+  }
+
+  if(!built)
+  {
+    index = (exact_index_t){0};
+  }
+  return index;
+}
+
+internal keylink_t* exact_index_lookup(exact_index_t* index, breakdown_t* breakdown)
+{
+  keylink_t* result = 0;
+
+  if(index->slot_count && breakdown_fits_packed_key(breakdown))
+  {
+    packed_key_t key = pack_breakdown(breakdown);
+    u64 hash = hash_exact_key(index, &key);
+    u32 pilot = index->pilots[exact_bucket_idx(index, hash)];
+    exact_slot_t* slot = index->slots + exact_slot_idx(index, hash, pilot);
+    if(slot->keylink && packed_key_eq(&slot->key, &key))
+    {
+      result = slot->keylink;
+    }
+  }
+
+  return result;
+}
+
+// Prints all single-word anagrams of word on one line.
+internal void print_exact_anagrams(exact_index_t* index, str_t word, u32 enabled_dictionaries)
+{
+  breakdown_t breakdown = breakdown_word(word);
+  keylink_t* keylink = exact_index_lookup(index, &breakdown);
+  b32 first = true;
+  for(wordlink_t* word_link = keylink ? &keylink->first_word : 0;
+      word_link;
+      word_link = word_link->next)
+  {
+    if(word_link->sources & enabled_dictionaries)
+    {
+      if(!first) { putchar(' '); }
+      fwrite(word_link->word.data, 1, word_link->word.size, stdout);
+      first = false;
+    }
+  }
+  putchar('\n');
+}
+
+// Letter values for --subwords --score: English Scrabble values for a-z, 1 for other letters.
+internal u32 breakdown_score(breakdown_t* breakdown)
+{
+  static u8 scrabble_scores[26] = {
+    1, 3, 3, 2, 1, 4, 2, 4, 1, 8, 5, 1, 3, 1, 1, 3, 10, 1, 1, 1, 1, 4, 4, 8, 4, 10,
+  };
+  u32 score = 0;
+
+  for(u32 idx = 0;
+      idx < global_alphabet.letter_count;
+      ++idx)
+  {
+    u32 letter = global_alphabet.letters[idx];
+    u32 letter_score = (letter >= 'a' && letter <= 'z') ? scrabble_scores[letter - 'a'] : 1;
+    score += letter_score * breakdown->counts[idx];
+  }
+
+  return score;
+}
+
+// Finds two-word phrases that are anagrams of a word, or of another phrase.
+// Scans split the table's buckets into ranges. A scan handles the letter
+// multisets that hash into its range, so it can check locally whether a
+// phrase's letters form a word. Since hashes add up, the bucket of a pair's
+// letters follows from its keys' buckets, and a scan only joins the pairs
+// that land in its range.
+#define DEFAULT_MAX_PHRASE_LETTERS 8
+
+// Pairs are collected for this many at a time, bucket by bucket.
+#define PHRASE_PAIR_CHUNK_SIZE (1u << 21)
+
+typedef struct
+{
+  keylink_t* keylink;
+  u32 letter_count;
+  u32 hash;  // hash_breakdown of the key.
+} pair_key_t;
+
+typedef struct
+{
+  u32 first_key_idx;  // first_key_idx <= second_key_idx, into the scan's keys.
+  u32 second_key_idx;
+  u32 next_pair_idx;
+} phrase_pair_t;
+
+// Phrases that share the same letters.
+typedef struct
+{
+  packed_key_t letters;
+  u32 pair_count;
+  u32 first_pair_idx;
+  u32 last_pair_idx;
+} phrase_cluster_t;
+
+typedef struct
+{
+  hashtable_t* hashtable;
+  u32 first_entry_idx;
+  u32 end_entry_idx;
+  u32 enabled_dictionaries;
+
+  // Keys short enough for phrases, by ascending letter count, then bucket.
+  // bucket_starts has a row of entry count + 1 indices into keys per letter
+  // count: where the keys of each bucket start.
+  pair_key_t* keys;
+  u32 key_count;
+  u32* bucket_starts;
+  u32 max_phrase_letters;
+
+  arena_t arena;
+  out_buf_t* out;
+  FILE* word_file;  // Phrases matching a word.
+  FILE* phrase_file;  // Phrases only matching other phrases.
+  b32 failed;
+} pair_scan_t;
+
+// Keys in the given bucket with these letters and enabled words.
+internal keylink_t* find_enabled_key(hashtable_t* hashtable, u32 entry_idx, packed_key_t* key,
+    u32 enabled_dictionaries)
+{
+  keylink_t* result = 0;
+
+  for(keylink_t* keylink = hashtable->entries[entry_idx];
+      keylink && !result;
+      keylink = keylink->next)
+  {
+    if(packed_key_eq(&keylink->key, key) && count_enabled_words(keylink, enabled_dictionaries))
+    {
+      result = keylink;
+    }
+  }
+
+  return result;
+}
+
+// hash_breakdown is linear in the counts, so hashes of sums and differences of
+// keys follow from the keys' hashes.
+typedef struct
+{
+  u32 empty_hash;
+  u32 letter_hashes[BREAKDOWN_WIDTH];  // What one more of each letter adds.
+} key_hash_steps_t;
+
+internal key_hash_steps_t get_key_hash_steps()
+{
+  key_hash_steps_t steps = {0};
+  breakdown_t letters = {0};
+  steps.empty_hash = hash_breakdown(&letters);
+  for(u32 letter = 0;
+      letter < array_count(steps.letter_hashes);
+      ++letter)
+  {
+    letters.counts[letter] = 1;
+    steps.letter_hashes[letter] = hash_breakdown(&letters) - steps.empty_hash;
+    letters.counts[letter] = 0;
+  }
+  return steps;
+}
+
+internal u32 key_entry_idx(hashtable_t* hashtable, u32 hash)
+{
+  return hash % array_count(hashtable->entries);
+}
+
+// Any total order, to list each split of a word once.
+internal b32 packed_key_before(packed_key_t* a, packed_key_t* b)
+{
+  u32 lane = array_count(a->lanes) - 1;
+  while(lane > 0 && a->lanes[lane] == b->lanes[lane])
+  {
+    --lane;
+  }
+  return a->lanes[lane] <= b->lanes[lane];
+}
+
+internal void out_enabled_words(out_buf_t* out, keylink_t* keylink, u32 enabled_dictionaries)
+{
+  for(wordlink_t* word_link = &keylink->first_word;
+      word_link;
+      word_link = word_link->next)
+  {
+    if(word_link->sources & enabled_dictionaries)
+    {
+      out_str(out, word_link->word);
+      out_char(out, '\n');
+    }
+  }
+}
+
+// Every phrase of a word from each key; equal keys give each word pair once.
+internal void out_phrases(out_buf_t* out, keylink_t* first, keylink_t* second,
+    u32 enabled_dictionaries)
+{
+  for(wordlink_t* first_word = &first->first_word;
+      first_word;
+      first_word = first_word->next)
+  {
+    if(!(first_word->sources & enabled_dictionaries))
+    {
+      continue;
+    }
+
+    for(wordlink_t* second_word = (first == second) ? first_word : &second->first_word;
+        second_word;
+        second_word = second_word->next)
+    {
+      if(second_word->sources & enabled_dictionaries)
+      {
+        out_str(out, first_word->word);
+        out_char(out, ' ');
+        out_str(out, second_word->word);
+        out_char(out, '\n');
+      }
+    }
+  }
+}
+
+// Splits every word in the scan's buckets into two keys, by counting through
+// all sub-multisets of its letters and looking both halves up.
+internal void scan_word_splits(pair_scan_t* scan)
+{
+  hashtable_t* hashtable = scan->hashtable;
+  key_hash_steps_t steps = get_key_hash_steps();
+
+  for(u32 entry_idx = scan->first_entry_idx;
+      entry_idx < scan->end_entry_idx;
+      ++entry_idx)
+  {
+    for(keylink_t* keylink = hashtable->entries[entry_idx];
+        keylink;
+        keylink = keylink->next)
+    {
+      if(!count_enabled_words(keylink, scan->enabled_dictionaries))
+      {
+        continue;
+      }
+
+      breakdown_t whole = unpack_key(&keylink->key);
+      u32 whole_hash = hash_breakdown(&whole);
+      u32 letters[BREAKDOWN_WIDTH];
+      u32 letter_count = 0;
+      for(u32 letter = 0;
+          letter < array_count(whole.counts);
+          ++letter)
+      {
+        if(whole.counts[letter] > 0)
+        {
+          letters[letter_count++] = letter;
+        }
+      }
+
+      // The part's counts, hash and packed key are updated in place.
+      breakdown_t part = {0};
+      u32 part_hash = steps.empty_hash;
+      packed_key_t part_key = {0};
+      b32 any_split = false;
+      for(;;)
+      {
+        // Mixed-radix increment, each count running from 0 to the word's.
+        u32 idx = 0;
+        for(;
+            idx < letter_count && part.counts[letters[idx]] == whole.counts[letters[idx]];
+            ++idx)
+        {
+          u32 letter = letters[idx];
+          part_hash -= (u32)whole.counts[letter] * steps.letter_hashes[letter];
+          part_key.lanes[letter / 16] -= (u64)whole.counts[letter] << (4 * (letter % 16));
+          part.counts[letter] = 0;
+        }
+        if(idx == letter_count)
+        {
+          break;
+        }
+        u32 letter = letters[idx];
+        ++part.counts[letter];
+        part_hash += steps.letter_hashes[letter];
+        part_key.lanes[letter / 16] += 1ull << (4 * (letter % 16));
+
+        packed_key_t rest_key;
+        for(u32 lane = 0;
+            lane < array_count(rest_key.lanes);
+            ++lane)
+        {
+          rest_key.lanes[lane] = keylink->key.lanes[lane] - part_key.lanes[lane];
+        }
+        if(packed_key_eq(&part_key, &keylink->key) || !packed_key_before(&part_key, &rest_key))
+        {
+          continue;
+        }
+
+        keylink_t* first = find_enabled_key(hashtable, key_entry_idx(hashtable, part_hash),
+            &part_key, scan->enabled_dictionaries);
+        if(first)
+        {
+          u32 rest_hash = whole_hash - (part_hash - steps.empty_hash);
+          keylink_t* second = find_enabled_key(hashtable, key_entry_idx(hashtable, rest_hash),
+              &rest_key, scan->enabled_dictionaries);
+          if(second)
+          {
+            if(!any_split)
+            {
+              out_char(scan->out, '\n');
+              out_enabled_words(scan->out, keylink, scan->enabled_dictionaries);
+              any_split = true;
+            }
+            out_phrases(scan->out, first, second, scan->enabled_dictionaries);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Joins the pairs of short keys whose letters hash into [first_entry_idx, end_entry_idx).
+// Counts each bucket's pairs into bucket_counts, or with bucket_ends, places
+// each pair after the earlier ones of its bucket, from where the previous
+// bucket's pairs end.
+internal void join_phrase_pairs(pair_scan_t* scan, u32 first_entry_idx, u32 end_entry_idx,
+    u64* bucket_counts, u32* bucket_ends, phrase_pair_t* pairs)
+{
+  pair_key_t* keys = scan->keys;
+  u32 entry_count = array_count(scan->hashtable->entries);
+  u32 entry_mask = entry_count - 1;
+  u32 empty_hash = get_key_hash_steps().empty_hash;
+
+  for(u32 first_idx = 0;
+      first_idx < scan->key_count;
+      ++first_idx)
+  {
+    pair_key_t* first = keys + first_idx;
+    for(u32 letter_count = first->letter_count;
+        first->letter_count + letter_count <= scan->max_phrase_letters;
+        ++letter_count)
+    {
+      // The second keys' buckets form a range too, which may wrap around.
+      u32* bucket_starts = scan->bucket_starts + letter_count * (entry_count + 1);
+      u32 range_start = (first_entry_idx + empty_hash - first->hash) & entry_mask;
+      u32 range_end = range_start + (end_entry_idx - first_entry_idx);
+      u32 ranges[2][2] = {
+        {range_start, min(range_end, entry_count)},
+        {0, range_end > entry_count ? range_end - entry_count : 0},
+      };
+
+      for(u32 range_idx = 0;
+          range_idx < array_count(ranges);
+          ++range_idx)
+      {
+        u32 second_idx = bucket_starts[ranges[range_idx][0]];
+        if(letter_count == first->letter_count)
+        {
+          second_idx = max(second_idx, first_idx);
+        }
+
+        for(;
+            second_idx < bucket_starts[ranges[range_idx][1]];
+            ++second_idx)
+        {
+          u32 entry_idx = (first->hash + keys[second_idx].hash - empty_hash) & entry_mask;
+          if(bucket_counts)
+          {
+            ++bucket_counts[entry_idx - first_entry_idx];
+          }
+          else
+          {
+            pairs[bucket_ends[entry_idx - first_entry_idx]++] =
+                (phrase_pair_t){first_idx, second_idx, U32_MAX};
+          }
+        }
+      }
+    }
+  }
+}
+
+// Groups the pairs in the scan's buckets by their letters and prints the groups
+// whose letters are not a word. Pairs are collected a chunk of buckets at a time.
+internal void scan_phrase_pairs(pair_scan_t* scan)
+{
+  hashtable_t* hashtable = scan->hashtable;
+  pair_key_t* keys = scan->keys;
+  u32 first_entry_idx = scan->first_entry_idx;
+
+  u64* bucket_counts = alloc_array_clear(&scan->arena, scan->end_entry_idx - first_entry_idx, u64);
+  if(!bucket_counts)
+  {
+    scan->failed = true;
+    return;
+  }
+  join_phrase_pairs(scan, first_entry_idx, scan->end_entry_idx, bucket_counts, 0, 0);
+
+  for(u32 chunk_start = first_entry_idx, chunk_end = first_entry_idx;
+      chunk_start < scan->end_entry_idx && !scan->failed;
+      chunk_start = chunk_end)
+  {
+    u64 chunk_pair_count = 0;
+    u64 max_bucket_count = 0;
+    for(;
+        chunk_end < scan->end_entry_idx &&
+        (chunk_end == chunk_start ||
+         chunk_pair_count + bucket_counts[chunk_end - first_entry_idx] <= PHRASE_PAIR_CHUNK_SIZE);
+        ++chunk_end)
+    {
+      u64 bucket_count = bucket_counts[chunk_end - first_entry_idx];
+      chunk_pair_count += bucket_count;
+      max_bucket_count = max(max_bucket_count, bucket_count);
+    }
+
+    // Pair indices and cluster slots are 32-bit, with U32_MAX ending the lists.
+    if(chunk_pair_count > U32_MAX / 4)
+    {
+      scan->failed = true;
+      break;
+    }
+
+    u32 cluster_capacity = 16;
+    while(cluster_capacity < 2 * max_bucket_count)
+    {
+      cluster_capacity *= 2;
+    }
+    u32 cluster_mask = cluster_capacity - 1;
+
+    arena_snap_t snap = arena_snap(&scan->arena);
+    u32 chunk_bucket_count = chunk_end - chunk_start;
+    u32* bucket_ends = alloc_array(&scan->arena, chunk_bucket_count, u32);
+    phrase_pair_t* pairs = alloc_array(&scan->arena, chunk_pair_count, phrase_pair_t);
+    phrase_cluster_t* clusters = alloc_array_clear(&scan->arena, cluster_capacity, phrase_cluster_t);
+    u32* cluster_order = alloc_array(&scan->arena, max_bucket_count, u32);
+    if(!bucket_ends || (chunk_pair_count && !pairs) || !clusters || (max_bucket_count && !cluster_order))
+    {
+      scan->failed = true;
+      break;
+    }
+
+    u32 bucket_start = 0;
+    for(u32 bucket_idx = 0;
+        bucket_idx < chunk_bucket_count;
+        ++bucket_idx)
+    {
+      bucket_ends[bucket_idx] = bucket_start;
+      bucket_start += (u32)bucket_counts[chunk_start - first_entry_idx + bucket_idx];
+    }
+    join_phrase_pairs(scan, chunk_start, chunk_end, 0, bucket_ends, pairs);
+
+    // Clusters are printed in the order their first pair was joined, and
+    // cleared again for the next bucket.
+    bucket_start = 0;
+    for(u32 bucket_idx = 0;
+        bucket_idx < chunk_bucket_count;
+        ++bucket_idx)
+    {
+      u32 cluster_count = 0;
+      for(u32 pair_idx = bucket_start;
+          pair_idx < bucket_ends[bucket_idx];
+          ++pair_idx)
+      {
+        // No count can exceed PACKED_KEY_MAX_COUNT, so the nibbles add without carries.
+        packed_key_t* first_key = &keys[pairs[pair_idx].first_key_idx].keylink->key;
+        packed_key_t* second_key = &keys[pairs[pair_idx].second_key_idx].keylink->key;
+        packed_key_t letters_key;
+        for(u32 lane = 0;
+            lane < array_count(letters_key.lanes);
+            ++lane)
+        {
+          letters_key.lanes[lane] = first_key->lanes[lane] + second_key->lanes[lane];
+        }
+
+        u32 cluster_idx = (u32)hash_packed_key(&letters_key) & cluster_mask;
+        while(clusters[cluster_idx].pair_count &&
+            !packed_key_eq(&clusters[cluster_idx].letters, &letters_key))
+        {
+          cluster_idx = (cluster_idx + 1) & cluster_mask;
+        }
+
+        phrase_cluster_t* cluster = clusters + cluster_idx;
+        if(cluster->pair_count)
+        {
+          pairs[cluster->last_pair_idx].next_pair_idx = pair_idx;
+        }
+        else
+        {
+          cluster->letters = letters_key;
+          cluster->first_pair_idx = pair_idx;
+          cluster_order[cluster_count++] = cluster_idx;
+        }
+        cluster->last_pair_idx = pair_idx;
+        ++cluster->pair_count;
+      }
+
+      for(u32 order_idx = 0;
+          order_idx < cluster_count;
+          ++order_idx)
+      {
+        phrase_cluster_t* cluster = clusters + cluster_order[order_idx];
+        if(cluster->pair_count >= 2 &&
+            !find_enabled_key(hashtable, chunk_start + bucket_idx, &cluster->letters,
+                scan->enabled_dictionaries))
+        {
+          out_char(scan->out, '\n');
+          for(u32 pair_idx = cluster->first_pair_idx;
+              pair_idx != U32_MAX;
+              pair_idx = pairs[pair_idx].next_pair_idx)
+          {
+            out_phrases(scan->out, keys[pairs[pair_idx].first_key_idx].keylink,
+                keys[pairs[pair_idx].second_key_idx].keylink, scan->enabled_dictionaries);
+          }
+        }
+        *cluster = (phrase_cluster_t){0};
+      }
+      bucket_start = bucket_ends[bucket_idx];
+    }
+
+    arena_restore(snap);
+  }
+}
+
+internal void* scan_anagram_pairs(void* data)
+{
+  pair_scan_t* scan = (pair_scan_t*)data;
+
+  // Each scan writes to its own temporary files.
+  scan->out = alloc_struct(&scan->arena, out_buf_t);
+  scan->word_file = tmpfile();
+  scan->phrase_file = tmpfile();
+  if(scan->out && scan->word_file && scan->phrase_file)
+  {
+    *scan->out = (out_buf_t){ .file = scan->word_file };
+    scan_word_splits(scan);
+    out_flush(scan->out);
+
+    scan->out->file = scan->phrase_file;
+    scan_phrase_pairs(scan);
+    out_flush(scan->out);
+  }
+  else
+  {
+    scan->failed = true;
+  }
+
+  clear_arena(&scan->arena);
+  return 0;
+}
+
+// Copies a scan's temporary file to stdout and closes it.
+internal void print_scan_file(FILE* file)
+{
+  if(file)
+  {
+    char buffer[64 * 1024];
+    rewind(file);
+    for(size_t size = fread(buffer, 1, sizeof(buffer), file);
+        size > 0;
+        size = fread(buffer, 1, sizeof(buffer), file))
+    {
+      fwrite(buffer, 1, size, stdout);
+    }
+    fclose(file);
+  }
+}
+
+// Prints groups of phrases: first those with a single-word anagram (which
+// leads the group), then phrases of up to max_phrase_letters letters that
+// only have other phrases as anagrams. Returns false if out of memory, with
+// the output incomplete.
+internal b32 list_anagram_pairs(hashtable_t* hashtable, arena_t* arena, u32 max_phrase_letters,
+    u32 enabled_dictionaries)
+{
+  assert(max_phrase_letters <= PACKED_KEY_MAX_COUNT);
+  // Buckets of sums are found by masking, as for key_entry_idx.
+  assert((array_count(hashtable->entries) & (array_count(hashtable->entries) - 1)) == 0);
+
+  // Counting sort of the short keys by letter count, then bucket; a key's
+  // bucket is the one it is stored in.
+  u32 entry_count = array_count(hashtable->entries);
+  u32 row_size = entry_count + 1;
+  u32* bucket_starts = alloc_array_clear(arena, (max_phrase_letters + 1) * row_size, u32);
+  u32* bucket_cursors = alloc_array(arena, (max_phrase_letters + 1) * row_size, u32);
+  pair_key_t* keys = 0;
+  u32 key_count = 0;
+  if(!bucket_starts || !bucket_cursors)
+  {
+    return false;
+  }
+  for(u32 pass = 0;
+      pass < 2;
+      ++pass)
+  {
+    if(pass == 1)
+    {
+      for(u32 idx = 1;
+          idx < (max_phrase_letters + 1) * row_size;
+          ++idx)
+      {
+        bucket_starts[idx] += bucket_starts[idx - 1];
+        bucket_cursors[idx] = bucket_starts[idx];
+      }
+      bucket_cursors[0] = 0;
+      key_count = bucket_starts[(max_phrase_letters + 1) * row_size - 1];
+      keys = alloc_array(arena, key_count, pair_key_t);
+      if(!keys)
+      {
+        return false;
+      }
+    }
+
+    for(u32 entry_idx = 0;
+        entry_idx < entry_count;
+        ++entry_idx)
+    {
+      for(keylink_t* keylink = hashtable->entries[entry_idx];
+          keylink;
+          keylink = keylink->next)
+      {
+        breakdown_t letters = unpack_key(&keylink->key);
+        u32 letter_count = (u32)breakdown_sum(&letters);
+        if(letter_count > 0 && letter_count <= max_phrase_letters &&
+            count_enabled_words(keylink, enabled_dictionaries))
+        {
+          u32 row_idx = letter_count * row_size + entry_idx;
+          if(pass == 0)
+          {
+            ++bucket_starts[row_idx + 1];
+          }
+          else
+          {
+            keys[bucket_cursors[row_idx]++] =
+                (pair_key_t){keylink, letter_count, hash_breakdown(&letters)};
+          }
+        }
+      }
+    }
+  }
+
+  u32 scan_count = default_thread_count();
+  pair_scan_t* scans = alloc_array_clear(arena, scan_count, pair_scan_t);
+  if(!scans)
+  {
+    return false;
+  }
+  for(u32 scan_idx = 0;
+      scan_idx < scan_count;
+      ++scan_idx)
+  {
+    pair_scan_t* scan = scans + scan_idx;
+    scan->hashtable = hashtable;
+    scan->first_entry_idx = (u32)(((u64)entry_count * scan_idx) / scan_count);
+    scan->end_entry_idx = (u32)(((u64)entry_count * (scan_idx + 1)) / scan_count);
+    scan->enabled_dictionaries = enabled_dictionaries;
+    scan->keys = keys;
+    scan->key_count = key_count;
+    scan->bucket_starts = bucket_starts;
+    scan->max_phrase_letters = max_phrase_letters;
+    scan->arena = new_arena();
+  }
+
+  run_in_threads(scan_anagram_pairs, scans, sizeof(pair_scan_t), scan_count, scan_count);
+
+  // Bucket order, independent of how the scans were scheduled.
+  b32 complete = true;
+  for(u32 scan_idx = 0;
+      scan_idx < scan_count;
+      ++scan_idx)
+  {
+    print_scan_file(scans[scan_idx].word_file);
+    complete &= !scans[scan_idx].failed;
+  }
+  for(u32 scan_idx = 0;
+      scan_idx < scan_count;
+      ++scan_idx)
+  {
+    print_scan_file(scans[scan_idx].phrase_file);
+  }
+
+  return complete;
+}
+
+// Prints every word that can be made from a subset of the input letters,
+// best first (longest, or highest scoring). Letters filled in by wildcards score nothing.
+internal void list_subwords(hashtable_t* hashtable, arena_t* arena, out_buf_t* out,
+    breakdown_t* input_breakdown, i32 wildcards, u32 enabled_dictionaries, b32 by_score)
+{
+  arena_snap_t snap = arena_snap(arena);
+  packed_key_t packed_input = pack_breakdown(input_breakdown);
+
+  // Keys are referenced in place, not copied.
+  u32 match_capacity = 1024;
+  u32 match_count = 0;
+  keylink_t** matches = alloc_array(arena, match_capacity, keylink_t*);
+  u32* match_values = alloc_array(arena, match_capacity, u32);
+  u32 max_value = 0;
+  for(u32 entry_idx = 0;
+      entry_idx < array_count(hashtable->entries);
+      ++entry_idx)
+  {
+    for(keylink_t* key_link = hashtable->entries[entry_idx];
+        key_link;
+        key_link = key_link->next)
+    {
+      if(packed_key_contains_with_wildcards(&packed_input, input_breakdown, &key_link->key, wildcards))
+      {
+        if(match_count == match_capacity)
+        {
+          keylink_t** new_matches = alloc_array(arena, 2 * match_capacity, keylink_t*);
+          u32* new_values = alloc_array(arena, 2 * match_capacity, u32);
+          for(u32 match_idx = 0;
+              match_idx < match_count;
+              ++match_idx)
+          {
+            new_matches[match_idx] = matches[match_idx];
+            new_values[match_idx] = match_values[match_idx];
+          }
+          matches = new_matches;
+          match_values = new_values;
+          match_capacity *= 2;
+        }
+
+        breakdown_t key = unpack_key(&key_link->key);
+        u32 value = (u32)breakdown_sum(&key);
+        if(by_score)
+        {
+          breakdown_t blanks = key;
+          breakdown_subtract(&blanks, input_breakdown);
+          breakdown_max0(&blanks);
+          value = breakdown_score(&key) - breakdown_score(&blanks);
+        }
+        matches[match_count] = key_link;
+        match_values[match_count] = value;
+        max_value = max(max_value, value);
+        ++match_count;
+      }
+    }
+  }
+
+  // Counting sort, best first.
+  u32* value_starts = alloc_array_clear(arena, max_value + 2, u32);
+  for(u32 match_idx = 0;
+      match_idx < match_count;
+      ++match_idx)
+  {
+    ++value_starts[max_value - match_values[match_idx] + 1];
+  }
+  for(u32 value_idx = 0;
+      value_idx <= max_value;
+      ++value_idx)
+  {
+    value_starts[value_idx + 1] += value_starts[value_idx];
+  }
+  keylink_t** sorted = alloc_array(arena, match_count, keylink_t*);
+  for(u32 match_idx = 0;
+      match_idx < match_count;
+      ++match_idx)
+  {
+    sorted[value_starts[max_value - match_values[match_idx]]++] = matches[match_idx];
+  }
+
+  for(u32 match_idx = 0;
+      match_idx < match_count;
+      ++match_idx)
+  {
+    for(wordlink_t* word_link = &sorted[match_idx]->first_word;
+        word_link;
+        word_link = word_link->next)
+    {
+      if(word_link->sources & enabled_dictionaries)
+      {
+        out_str(out, word_link->word);
+        out_char(out, '\n');
+      }
+    }
+  }
+
+  arena_restore(snap);
+}
+
+internal wordlink_t* parse_excluded_words(arena_t* arena, str_t space_separated_must_exclude)
+{
+  wordlink_t* excluded_words = 0;
+
+  // Separate excluded words by space.
+  for(i32 idx = 0, last_wordstart = 0;
+      idx <= space_separated_must_exclude.size;
+      ++idx)
+  {
+    if(idx == space_separated_must_exclude.size ||
+        space_separated_must_exclude.data[idx] == ' ')
+    {
+      i32 size = idx - last_wordstart;
+      if(size > 0)
+      {
+        str_t word = {
+          .size = (u32)size,
+          .data = space_separated_must_exclude.data + last_wordstart,
+        };
+        wordlink_t* new_excluded_word = alloc_struct(arena, wordlink_t);
+        new_excluded_word->word = word;
+        new_excluded_word->next = excluded_words;
+        excluded_words = new_excluded_word;
+      }
+      last_wordstart = idx + 1;
+    }
+  }
+
+  return excluded_words;
+}
+
+// Lets the arena grow by at most the query's memory budget. Returns the
+// previous limit, to be restored when the query is done.
+internal size_t begin_arena_budget(arena_t* arena, query_limits_t* limits)
+{
+  size_t previous_max_capacity = arena->max_capacity;
+  if(limits->memory_budget)
+  {
+    arena->max_capacity = arena->total_capacity + limits->memory_budget;
+  }
+  arena->out_of_memory = false;
+  return previous_max_capacity;
+}
+
+// Finds words that could fit into the input, longest keys first. Stops early,
+// with the keys found so far, if the arena runs out of memory.
+internal subkey_t* collect_subkeys(hashtable_t* hashtable, arena_t* arena,
+    breakdown_t* input_breakdown, i32 wildcards, wordlink_t* excluded_words,
+    u32 enabled_dictionaries)
+{
+  subkey_t* subkeys = 0;
+  packed_key_t packed_input = pack_breakdown(input_breakdown);
+
+  for(u32 entry_idx = 0;
+      entry_idx < array_count(hashtable->entries) && !arena->out_of_memory;
+      ++entry_idx)
+  {
+    for(keylink_t* key_link = hashtable->entries[entry_idx];
+        key_link;
+        key_link = key_link->next)
+    {
+      if(packed_key_contains_with_wildcards(&packed_input, input_breakdown, &key_link->key, wildcards))
+      {
+        wordlink_t* current_wordlink = 0;
+
+        for(wordlink_t* test_wordlink = &key_link->first_word;
+            test_wordlink && !arena->out_of_memory;
+            test_wordlink = test_wordlink->next)
+        {
+          str_t word = test_wordlink->word;
+
+          b32 excluded = !(test_wordlink->sources & enabled_dictionaries);
+          for(wordlink_t* excluded_word = excluded_words;
+              excluded_word && !excluded;
+              excluded_word = excluded_word->next)
+          {
+            if(str_eq(word, excluded_word->word))
+            {
+              excluded = true;
+            }
+          }
+
+          if(!excluded)
+          {
+            wordlink_t* new_wordlink = 0;
+            if(!current_wordlink)
+            {
+              // Insert longest words first.
+              breakdown_t key = unpack_key(&key_link->key);
+              u32 key_sum = breakdown_sum(&key);
+              subkey_t** subkey = &subkeys;
+              while(*subkey && breakdown_sum(&(*subkey)->key) >= key_sum)
+              {
+                subkey = &(*subkey)->next;
+              }
+
+              subkey_t* new_subkey = alloc_struct(arena, subkey_t);
+              if(new_subkey)
+              {
+                new_subkey->key = key;
+                new_subkey->next = *subkey;
+                *subkey = new_subkey;
+                new_wordlink = &new_subkey->first_word;
+              }
+            }
+            else
+            {
+              new_wordlink = alloc_struct(arena, wordlink_t);
+              if(new_wordlink)
+              {
+                current_wordlink->next = new_wordlink;
+              }
+            }
+
+            if(new_wordlink)
+            {
+              current_wordlink = new_wordlink;
+              current_wordlink->word = word;
+              current_wordlink->sources = test_wordlink->sources;
+              current_wordlink->next = 0;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return subkeys;
+}
+
+internal void print_search_stats_json(FILE* file, search_stats_t* stats)
+{
+  fprintf(file, "{\"nodes_visited\": %" PRIu64 ", \"containment_checks\": %" PRIu64
+      ", \"subtractions\": %" PRIu64 ", \"backtracks\": %" PRIu64 ", \"results\": %" PRIu64
+      ", \"max_chain_depth\": %u, \"collect_seconds\": %.6f, \"search_seconds\": %.6f"
+      ", \"output_seconds\": %.6f}",
+      stats->nodes_visited, stats->containment_checks, stats->subtractions, stats->backtracks,
+      stats->results, stats->max_chain_depth,
+      (f64)stats->collect_ns / 1e9, (f64)stats->search_ns / 1e9, (f64)stats->output_ns / 1e9);
+}
+
+// Partial results are reported on stderr. Returns the process exit code.
+internal int report_stop_reason(stop_reason_t stop_reason)
+{
+  int exit_code = 0;
+
+  if(stop_reason == STOP_DEADLINE || stop_reason == STOP_MEMORY)
+  {
+    fprintf(stderr, "Stopped at %s, results are incomplete.\n", stop_reason_names[stop_reason]);
+    exit_code = 2;
+  }
+  else if(stop_reason == STOP_CANCELLED)
+  {
+    fprintf(stderr, "Interrupted, results are incomplete.\n");
+    exit_code = 128 + SIGINT;
+  }
+
+  return exit_code;
+}
+
+typedef enum
+{
+  SEARCH_PAUSED,
+  SEARCH_FOUND,
+  SEARCH_DONE,
+} search_status_t;
+
+// Chain search: combinations are chains of candidates in list order, each
+// extended by the first candidate at or after its last one that still fits.
+// Candidates are copied into arrays for it, so that most of them are ruled
+// out by their letter count and letter mask, a few dense bytes each, without
+// looking at the key.
+#define CANDIDATE_KEY_ALIGNMENT 64
+
+typedef struct
+{
+  u32 count;
+  breakdown_t* keys;
+  u16* letter_counts;  // Sum of each key, descending like the list.
+  u64* letter_masks;   // Bit per letter the key has.
+  subkey_t** subkeys;  // For the words.
+} candidate_set_t;
+
+typedef struct
+{
+  candidate_set_t candidates;
+
+  breakdown_t remaining_breakdown;
+  i32 remaining_letters;  // Sum of the remaining counts.
+  u64 remaining_mask;     // Letters with a positive remaining count.
+  i32 wildcards;
+
+  u64 step_count;
+  b32 visited;  // Whether the current chain was checked for completeness.
+  u32 next_min_candidate;
+  u32 max_chain_length;
+  u32 chain_length;
+  u32* chain_candidates;
+
+  subkey_t** chain;  // The last combination found.
+} chain_search_t;
+
+internal u64 breakdown_letter_mask(breakdown_t* breakdown)
+{
+  u64 mask = 0;
+
+#ifdef __SSE2__
+  for(u32 offset = 0;
+      offset < BREAKDOWN_WIDTH;
+      offset += 16)
+  {
+    __m128i counts = _mm_loadu_si128((__m128i*)(breakdown->counts + offset));
+    u32 positive = (u32)_mm_movemask_epi8(_mm_cmpgt_epi8(counts, _mm_setzero_si128()));
+    mask |= (u64)positive << offset;
+  }
+#else
+  for(u32 letter = 0;
+      letter < BREAKDOWN_WIDTH;
+      ++letter)
+  {
+    mask |= (u64)(breakdown->counts[letter] > 0) << letter;
+  }
+#endif
+
+  return mask;
+}
+
+// Returns false if out of memory.
+internal b32 build_candidate_set(arena_t* arena, subkey_t* subkeys, candidate_set_t* candidates)
+{
+  *candidates = (candidate_set_t){0};
+  for(subkey_t* subkey = subkeys;
+      subkey;
+      subkey = subkey->next)
+  {
+    ++candidates->count;
+  }
+
+  candidates->keys = alloc_bytes_aligned(arena, candidates->count * sizeof(breakdown_t),
+      CANDIDATE_KEY_ALIGNMENT);
+  candidates->letter_counts = alloc_array(arena, candidates->count, u16);
+  candidates->letter_masks = alloc_array(arena, candidates->count, u64);
+  candidates->subkeys = alloc_array(arena, candidates->count, subkey_t*);
+
+  b32 allocated = (candidates->keys && candidates->letter_counts && candidates->letter_masks &&
+      candidates->subkeys);
+  u32 candidate_idx = 0;
+  for(subkey_t* subkey = subkeys;
+      subkey && allocated;
+      subkey = subkey->next)
+  {
+    candidates->keys[candidate_idx] = subkey->key;
+    candidates->letter_counts[candidate_idx] = (u16)breakdown_sum(&subkey->key);
+    candidates->letter_masks[candidate_idx] = breakdown_letter_mask(&subkey->key);
+    candidates->subkeys[candidate_idx] = subkey;
+    ++candidate_idx;
+  }
+
+  return allocated;
+}
+
+// First candidate from first_idx on that fits the remaining letters, or U32_MAX.
+internal u32 find_fitting_candidate(chain_search_t* search, u32 first_idx, search_stats_t* stats)
+{
+  candidate_set_t* candidates = &search->candidates;
+  i32 wildcards = search->wildcards;
+  i32 room = search->remaining_letters + wildcards;
+
+  // Longer candidates come first, so the ones that are too long are a prefix.
+  u32 candidate_idx = first_idx;
+  while(candidate_idx < candidates->count && candidates->letter_counts[candidate_idx] > room)
+  {
+    ++candidate_idx;
+  }
+
+  u32 result = U32_MAX;
+  for(;
+      candidate_idx < candidates->count && result == U32_MAX;
+      ++candidate_idx)
+  {
+    stat_add(stats, containment_checks, 1);
+    // Each letter the remaining letters lack takes a wildcard.
+    u64 lacking = candidates->letter_masks[candidate_idx] & ~search->remaining_mask;
+    if((lacking == 0 || __builtin_popcountll(lacking) <= wildcards) &&
+        breakdown_contains_with_wildcards(&search->remaining_breakdown,
+          &candidates->keys[candidate_idx], wildcards))
+    {
+      result = candidate_idx;
+    }
+  }
+
+  return result;
+}
+
+internal void push_chain_candidate(chain_search_t* search, u32 candidate_idx, search_stats_t* stats)
+{
+  assert(search->chain_length < search->max_chain_length);
+  search->chain_candidates[search->chain_length++] = candidate_idx;
+  breakdown_subtract(&search->remaining_breakdown, &search->candidates.keys[candidate_idx]);
+  assert(breakdown_deficit(&search->remaining_breakdown) <= search->wildcards);
+  search->remaining_letters -= search->candidates.letter_counts[candidate_idx];
+  search->remaining_mask = breakdown_letter_mask(&search->remaining_breakdown);
+  search->next_min_candidate = candidate_idx;
+  stat_add(stats, subtractions, 1);
+  stat_max(stats, max_chain_depth, search->chain_length);
+}
+
+internal u32 pop_chain_candidate(chain_search_t* search)
+{
+  u32 candidate_idx = search->chain_candidates[--search->chain_length];
+  breakdown_add(&search->remaining_breakdown, &search->candidates.keys[candidate_idx]);
+  search->remaining_letters += search->candidates.letter_counts[candidate_idx];
+  search->remaining_mask = breakdown_letter_mask(&search->remaining_breakdown);
+  return candidate_idx;
+}
+
+// Returns 0 if out of memory.
+internal chain_search_t* begin_chain_search(arena_t* arena, subkey_t* subkeys,
+    breakdown_t* letters, i32 wildcards, search_stats_t* stats)
+{
+  chain_search_t* search = alloc_struct_clear(arena, chain_search_t);
+  if(search && build_candidate_set(arena, subkeys, &search->candidates))
+  {
+    search->remaining_breakdown = *letters;
+    search->remaining_letters = breakdown_sum(letters);
+    search->remaining_mask = breakdown_letter_mask(letters);
+    search->wildcards = wildcards;
+    search->max_chain_length = max(1, breakdown_sum(letters) + wildcards);
+    search->chain_candidates = alloc_array(arena, search->max_chain_length, u32);
+    search->chain = alloc_array(arena, search->max_chain_length, subkey_t*);
+
+    if(search->chain_candidates && search->chain && search->candidates.count > 0)
+    {
+      push_chain_candidate(search, 0, stats);
+    }
+    else
+    {
+      search = 0;
+    }
+  }
+  else
+  {
+    search = 0;
+  }
+
+  return search;
+}
+
+// Searches for up to max_steps steps. After SEARCH_FOUND, the combination is
+// in search->chain until the next call.
+internal search_status_t next_chain_combination(chain_search_t* search, u32 max_steps,
+    search_stats_t* stats)
+{
+  search_status_t status = SEARCH_PAUSED;
+
+  for(u32 step = 0;
+      step < max_steps && status == SEARCH_PAUSED && search->chain_length > 0;
+      ++step)
+  {
+    ++search->step_count;
+    if(!search->visited)
+    {
+      search->visited = true;
+      stat_add(stats, nodes_visited, 1);
+      if(breakdown_is_complete(&search->remaining_breakdown, search->wildcards))
+      {
+        for(u32 chain_idx = 0;
+            chain_idx < search->chain_length;
+            ++chain_idx)
+        {
+          search->chain[chain_idx] = search->candidates.subkeys[search->chain_candidates[chain_idx]];
+        }
+        status = SEARCH_FOUND;
+      }
+    }
+    else
+    {
+      // Try adding a new chain element, or else changing the last one.
+      u32 next_candidate = find_fitting_candidate(search, search->next_min_candidate, stats);
+      if(next_candidate == U32_MAX)
+      {
+        u32 prev_last_candidate = pop_chain_candidate(search);
+        stat_add(stats, backtracks, 1);
+        next_candidate = find_fitting_candidate(search, prev_last_candidate + 1, stats);
+      }
+
+      if(next_candidate != U32_MAX)
+      {
+        push_chain_candidate(search, next_candidate, stats);
+        search->visited = false;
+      }
+      else
+      {
+        // The shorter chain was visited before; only backtracking is left.
+        search->next_min_candidate = search->candidates.count;
+      }
+    }
+  }
+
+  if(status == SEARCH_PAUSED && search->chain_length == 0)
+  {
+    status = SEARCH_DONE;
+  }
+
+  return status;
+}
+
+// Exact-cover search: every input letter has to be covered by some word, so
+// each level branches over the candidates containing the letter with the
+// fewest of them. Candidates before the chosen one that contain the letter
+// are dropped below the branch, which finds every combination exactly once.
+// Letters left over for wildcards are covered by candidates in list order.
+#define COVER_BLANKS U32_MAX
+
+typedef struct
+{
+  u32* candidates;  // Indices into the search's subkeys that still fit, ascending.
+  u32 candidate_count;
+  u32 next_candidate;
+  u32 letter;  // Letter each branch covers, or COVER_BLANKS.
+  arena_snap_t snap;
+} cover_level_t;
+
+typedef struct
+{
+  arena_t* arena;
+  subkey_t** subkeys;
+  u32 subkey_count;
+
+  breakdown_t remaining_breakdown;
+  i32 wildcards;
+
+  u64 step_count;
+  u32 max_level_count;
+  u32 level_count;
+  cover_level_t* levels;
+  u32* chosen;  // Subkey chosen at each level but the last.
+
+  // The last combination found, in subkey order like the chain search's.
+  u32 chain_length;
+  u32* chain_subkeys;
+  subkey_t** chain;
+} cover_search_t;
+
+// Adds a level below the current one, for branch `subkey_idx` of the parent.
+internal void push_cover_level(cover_search_t* search, u32 subkey_idx, search_stats_t* stats)
+{
+  assert(search->level_count < search->max_level_count);
+  cover_level_t* parent = search->level_count ? search->levels + search->level_count - 1 : 0;
+  cover_level_t* level = search->levels + search->level_count++;
+  arena_t* arena = search->arena;
+  breakdown_t* remaining = &search->remaining_breakdown;
+
+  *level = (cover_level_t){0};
+  level->snap = arena_snap(arena);
+  level->letter = COVER_BLANKS;
+
+  u32 parent_count = parent ? parent->candidate_count : search->subkey_count;
+  level->candidates = alloc_array(arena, parent_count, u32);
+  if(!level->candidates)
+  {
+    // Out of memory; the level has no branches.
+    return;
+  }
+
+  u32 letter_counts[BREAKDOWN_WIDTH] = {0};
+  for(u32 idx = 0;
+      idx < parent_count;
+      ++idx)
+  {
+    u32 candidate = parent ? parent->candidates[idx] : idx;
+    breakdown_t* key = &search->subkeys[candidate]->key;
+
+    b32 dropped = false;
+    if(parent && candidate < subkey_idx)
+    {
+      dropped = (parent->letter == COVER_BLANKS || key->counts[parent->letter] > 0);
+    }
+
+    if(!dropped)
+    {
+      stat_add(stats, containment_checks, 1);
+      if(breakdown_contains_with_wildcards(remaining, key, search->wildcards))
+      {
+        level->candidates[level->candidate_count++] = candidate;
+        for(u32 letter = 0;
+            letter < array_count(letter_counts);
+            ++letter)
+        {
+          letter_counts[letter] += (key->counts[letter] > 0);
+        }
+      }
+    }
+  }
+
+  u32 fewest = U32_MAX;
+  for(u32 letter = 0;
+      letter < array_count(letter_counts);
+      ++letter)
+  {
+    if(remaining->counts[letter] > 0 && letter_counts[letter] < fewest)
+    {
+      fewest = letter_counts[letter];
+      level->letter = letter;
+    }
+  }
+}
+
+internal void pop_cover_level(cover_search_t* search)
+{
+  cover_level_t* level = search->levels + --search->level_count;
+  arena_restore(level->snap);
+  if(search->level_count > 0)
+  {
+    breakdown_add(&search->remaining_breakdown,
+        &search->subkeys[search->chosen[search->level_count - 1]]->key);
+  }
+}
+
+// Returns 0 if out of memory.
+internal cover_search_t* begin_cover_search(arena_t* arena, subkey_t* subkeys,
+    breakdown_t* letters, i32 wildcards, search_stats_t* stats)
+{
+  cover_search_t* search = alloc_struct_clear(arena, cover_search_t);
+  if(search)
+  {
+    for(subkey_t* subkey = subkeys;
+        subkey;
+        subkey = subkey->next)
+    {
+      ++search->subkey_count;
+    }
+
+    search->arena = arena;
+    search->remaining_breakdown = *letters;
+    search->wildcards = wildcards;
+    // Every word covers at least one letter or wildcard.
+    search->max_level_count = max(1, breakdown_sum(letters) + wildcards) + 1;
+    search->subkeys = alloc_array(arena, search->subkey_count, subkey_t*);
+    search->levels = alloc_array(arena, search->max_level_count, cover_level_t);
+    search->chosen = alloc_array(arena, search->max_level_count, u32);
+    search->chain_subkeys = alloc_array(arena, search->max_level_count, u32);
+    search->chain = alloc_array(arena, search->max_level_count, subkey_t*);
+
+    if(search->subkeys && search->levels && search->chosen && search->chain_subkeys && search->chain)
+    {
+      u32 subkey_idx = 0;
+      for(subkey_t* subkey = subkeys;
+          subkey;
+          subkey = subkey->next)
+      {
+        search->subkeys[subkey_idx++] = subkey;
+      }
+      push_cover_level(search, 0, stats);
+    }
+    else
+    {
+      search = 0;
+    }
+  }
+
+  return search;
+}
+
+// Searches for up to max_steps branches. After SEARCH_FOUND, the combination is
+// in search->chain until the next call.
+internal search_status_t next_cover_combination(cover_search_t* search, u32 max_steps,
+    search_stats_t* stats)
+{
+  search_status_t status = SEARCH_PAUSED;
+
+  for(u32 step = 0;
+      step < max_steps && status == SEARCH_PAUSED && search->level_count > 0;
+      ++step)
+  {
+    ++search->step_count;
+    stat_add(stats, nodes_visited, 1);
+    cover_level_t* level = search->levels + search->level_count - 1;
+
+    // Next candidate covering the level's letter.
+    u32 subkey_idx = U32_MAX;
+    while(level->next_candidate < level->candidate_count && subkey_idx == U32_MAX)
+    {
+      u32 candidate = level->candidates[level->next_candidate++];
+      if(level->letter == COVER_BLANKS || search->subkeys[candidate]->key.counts[level->letter] > 0)
+      {
+        subkey_idx = candidate;
+      }
+    }
+
+    if(subkey_idx != U32_MAX)
+    {
+      search->chosen[search->level_count - 1] = subkey_idx;
+      breakdown_subtract(&search->remaining_breakdown, &search->subkeys[subkey_idx]->key);
+      stat_add(stats, subtractions, 1);
+      stat_max(stats, max_chain_depth, search->level_count);
+
+      if(breakdown_is_complete(&search->remaining_breakdown, search->wildcards))
+      {
+        // Sort the combination into subkey order.
+        search->chain_length = search->level_count;
+        for(u32 chain_idx = 0;
+            chain_idx < search->chain_length;
+            ++chain_idx)
+        {
+          u32 chosen = search->chosen[chain_idx];
+          u32 insert_idx = chain_idx;
+          for(;
+              insert_idx > 0 && search->chain_subkeys[insert_idx - 1] > chosen;
+              --insert_idx)
+          {
+            search->chain_subkeys[insert_idx] = search->chain_subkeys[insert_idx - 1];
+          }
+          search->chain_subkeys[insert_idx] = chosen;
+        }
+        for(u32 chain_idx = 0;
+            chain_idx < search->chain_length;
+            ++chain_idx)
+        {
+          search->chain[chain_idx] = search->subkeys[search->chain_subkeys[chain_idx]];
+        }
+        breakdown_add(&search->remaining_breakdown, &search->subkeys[subkey_idx]->key);
+        status = SEARCH_FOUND;
+      }
+      else
+      {
+        push_cover_level(search, subkey_idx, stats);
+      }
+    }
+    else
+    {
+      pop_cover_level(search);
+      stat_add(stats, backtracks, 1);
+    }
+  }
+
+  if(status == SEARCH_PAUSED && search->level_count == 0)
+  {
+    status = SEARCH_DONE;
+  }
+
+  return status;
+}
+
+// The search of the engine picked by --engine.
+typedef struct
+{
+  chain_search_t* chain_search;
+  cover_search_t* cover_search;
+  search_status_t status;
+  u64 step_count;
+
+  // The last combination found, until the next call.
+  u32 chain_length;
+  subkey_t** chain;
+
+  // Estimated steps below each top-level branch, summed up to the branch,
+  // for search_progress. Estimated on first use.
+  breakdown_t letters;
+  i32 wildcards;
+  b32 estimated;
+  u32 branch_count;
+  f64* branch_weights;  // branch_count + 1
+} search_t;
+
+// Returns 0 if out of memory.
+internal search_t* begin_search(arena_t* arena, subkey_t* subkeys, breakdown_t* letters,
+    i32 wildcards, search_stats_t* stats)
+{
+  search_t* search = alloc_struct_clear(arena, search_t);
+  u32 subkey_count = 0;
+  for(subkey_t* subkey = subkeys;
+      subkey;
+      subkey = subkey->next)
+  {
+    ++subkey_count;
+  }
+  if(search)
+  {
+    // Before the engine's search state, which cover levels free again.
+    search->letters = *letters;
+    search->wildcards = wildcards;
+    search->branch_weights = alloc_array(arena, subkey_count + 1, f64);
+    search = search->branch_weights ? search : 0;
+  }
+
+  if(search && global_search_engine == SEARCH_ENGINE_COVER)
+  {
+    search->cover_search = begin_cover_search(arena, subkeys, letters, wildcards, stats);
+    search = search->cover_search ? search : 0;
+  }
+  else if(search)
+  {
+    search->chain_search = begin_chain_search(arena, subkeys, letters, wildcards, stats);
+    search = search->chain_search ? search : 0;
+  }
+
+  return search;
+}
+
+internal search_status_t next_combination(search_t* search, u32 max_steps, search_stats_t* stats)
+{
+  if(search->cover_search)
+  {
+    cover_search_t* cover_search = search->cover_search;
+    search->status = next_cover_combination(cover_search, max_steps, stats);
+    search->step_count = cover_search->step_count;
+    search->chain_length = cover_search->chain_length;
+    search->chain = cover_search->chain;
+  }
+  else
+  {
+    chain_search_t* chain_search = search->chain_search;
+    search->status = next_chain_combination(chain_search, max_steps, stats);
+    search->step_count = chain_search->step_count;
+    search->chain_length = chain_search->chain_length;
+    search->chain = chain_search->chain;
+  }
+
+  return search->status;
+}
+
+// The steps below a top-level branch are estimated as (f + 1)^(r / 5), for f
+// candidates that still fit after it and r letters left: as if words were
+// five letters long and every level branched over all of those candidates.
+// f is counted on an evenly spread sample.
+#define PROGRESS_SAMPLE_COUNT 64
+#define PROGRESS_LETTERS_PER_WORD 5.0
+
+// Key of the top-level candidate at idx.
+internal breakdown_t* top_level_key(search_t* search, u32 idx)
+{
+  breakdown_t* key;
+  if(search->chain_search)
+  {
+    key = search->chain_search->candidates.keys + idx;
+  }
+  else
+  {
+    cover_search_t* cover_search = search->cover_search;
+    key = &cover_search->subkeys[cover_search->levels[0].candidates[idx]]->key;
+  }
+  return key;
+}
+
+internal void estimate_branch_weights(search_t* search)
+{
+  chain_search_t* chain_search = search->chain_search;
+  cover_level_t* top_level = chain_search ? 0 : search->cover_search->levels;
+  u32 branch_count = chain_search ? chain_search->candidates.count : top_level->candidate_count;
+  i32 letter_count = breakdown_sum(&search->letters) + search->wildcards;
+
+  search->branch_weights[0] = 0;
+  for(u32 branch_idx = 0;
+      branch_idx < branch_count;
+      ++branch_idx)
+  {
+    breakdown_t* key = top_level_key(search, branch_idx);
+    f64 steps = 0;
+
+    // Cover branches are the candidates with the level's letter.
+    b32 is_branch = (chain_search || top_level->letter == COVER_BLANKS ||
+        key->counts[top_level->letter] > 0);
+    if(is_branch)
+    {
+      breakdown_t remaining = search->letters;
+      breakdown_subtract(&remaining, key);
+
+      // Chain branches are followed by later candidates; cover branches by
+      // all but the earlier branches.
+      u32 first = chain_search ? branch_idx : 0;
+      u32 stride = max(1, (branch_count - first) / PROGRESS_SAMPLE_COUNT);
+      u32 sampled = 0;
+      u32 fitting = 0;
+      for(u32 idx = first;
+          idx < branch_count;
+          idx += stride)
+      {
+        breakdown_t* next_key = top_level_key(search, idx);
+        b32 dropped = (!chain_search && idx < branch_idx &&
+            (top_level->letter == COVER_BLANKS || next_key->counts[top_level->letter] > 0));
+        ++sampled;
+        fitting += (!dropped && breakdown_contains_with_wildcards(&remaining, next_key, search->wildcards));
+      }
+
+      f64 fitting_count = (f64)fitting * (branch_count - first) / sampled;
+      steps = pow(fitting_count + 1, (letter_count - breakdown_sum(key)) / PROGRESS_LETTERS_PER_WORD);
+    }
+    search->branch_weights[branch_idx + 1] = search->branch_weights[branch_idx] + steps;
+  }
+
+  search->branch_count = branch_count;
+  search->estimated = true;
+}
+
+// Estimated fraction of the search done, from 0 to 1: the branches before the
+// current top-level one, and the part of it before the second level's branch.
+internal f64 search_progress(search_t* search)
+{
+  f64 progress = 1;
+
+  chain_search_t* chain_search = search->chain_search;
+  cover_search_t* cover_search = search->cover_search;
+  b32 searching = (chain_search ? chain_search->chain_length > 0 : cover_search->level_count > 0);
+  if(searching && search->status != SEARCH_DONE)
+  {
+    if(!search->estimated)
+    {
+      estimate_branch_weights(search);
+    }
+
+    u32 branch_idx = 0;
+    f64 branch_progress = 0;
+    if(chain_search)
+    {
+      u32 first = chain_search->chain_candidates[0];
+      branch_idx = first;
+      if(chain_search->chain_length > 1)
+      {
+        branch_progress = (f64)(chain_search->chain_candidates[1] - first) /
+          (chain_search->candidates.count - first);
+      }
+    }
+    else
+    {
+      // The branch being explored is the one before next_candidate.
+      cover_level_t* levels = cover_search->levels;
+      branch_idx = max(1, levels[0].next_candidate) - 1;
+      if(cover_search->level_count > 1 && levels[1].candidate_count)
+      {
+        branch_progress = (f64)(max(1, levels[1].next_candidate) - 1) / levels[1].candidate_count;
+      }
+    }
+
+    f64* weights = search->branch_weights;
+    f64 total = weights[search->branch_count];
+    if(total > 0 && branch_idx < search->branch_count)
+    {
+      f64 done = weights[branch_idx] + branch_progress * (weights[branch_idx + 1] - weights[branch_idx]);
+      progress = min(1, done / total);
+    }
+    else
+    {
+      progress = 0;
+    }
+  }
+
+  return progress;
+}
+
+// Reports progress to the control, if any. Returns whether to stop.
+internal b32 check_search_control(search_control_t* control, search_t* search)
+{
+  if(control && control->report_progress)
+  {
+    control->report_progress(control->progress_data, search ? search_progress(search) : 1);
+  }
+  return control && control->cancelled;
+}
+
+// On-disk cache of complete one-shot results (--cache), one file per query.
+// Files are named by a hash of the dictionaries and the canonical query, and
+// hold the query itself to rule out collisions. Words are stored as their
+// offset into the concatenated dictionary texts. Hits refresh the file's
+// modification time, and the least recently used files go beyond the size cap.
+#define RESULT_CACHE_MAGIC 0x52474e41  // "ANGR"
+#define RESULT_CACHE_VERSION 1
+#define DEFAULT_RESULT_CACHE_SIZE (256ull * 1024 * 1024)
+#define MAX_RESULT_CACHE_PATH 4096
+#define RESULT_CACHE_NAME_SIZE 20  // 16 hex digits and ".res".
+
+typedef struct
+{
+  char* dir;
+  u64 max_size;
+  dictionary_source_t* sources;
+  u32 source_count;
+  u64 dictionary_hash;  // Texts, alphabet and load options.
+} result_cache_t;
+
+typedef struct
+{
+  u32 magic;
+  u32 version;
+  u64 dictionary_hash;
+  u32 query_size;
+  u32 result_count;
+  u64 id_count;
+  // Followed by the query, then per result its word count and word IDs (u32).
+} result_cache_header_t;
+
+// A query's results in cache form, collected while printing.
+typedef struct
+{
+  result_cache_t* cache;
+  b32 cacheable;
+  u64 header_size;  // Header and padded query, ahead of the IDs in the file.
+  u32 result_count;
+  u64 id_count;
+  u64 id_capacity;
+  u32* ids;
+} result_record_t;
+
+internal u64 hash_bytes(u64 hash, void* data, size_t size)
+{
+  u8* bytes = (u8*)data;
+  for(size_t idx = 0;
+      idx < size;
+      idx += 8)
+  {
+    u64 chunk = 0;
+    for(u32 byte_idx = 0;
+        byte_idx < 8 && idx + byte_idx < size;
+        ++byte_idx)
+    {
+      chunk |= (u64)bytes[idx + byte_idx] << (8 * byte_idx);
+    }
+    hash = mix64(hash ^ chunk);
+  }
+  return mix64(hash ^ size);
+}
+
+internal result_cache_t begin_result_cache(char* dir, u64 max_size,
+    dictionary_source_t* sources, u32 source_count, b32 include_uppercase, b32 fold_case)
+{
+  result_cache_t cache = {0};
+  cache.dir = dir;
+  cache.max_size = max_size;
+  cache.sources = sources;
+  cache.source_count = source_count;
+
+  u64 hash = hash_bytes(RESULT_CACHE_VERSION, &global_alphabet, sizeof(global_alphabet));
+  u32 options[] = {include_uppercase, fold_case, BREAKDOWN_WIDTH};
+  hash = hash_bytes(hash, options, sizeof(options));
+  for(u32 source_idx = 0;
+      source_idx < source_count;
+      ++source_idx)
+  {
+    hash = hash_bytes(hash, sources[source_idx].text.data, sources[source_idx].text.size);
+  }
+  cache.dictionary_hash = hash;
+
+  // A missing directory is created, but not its parents.
+  struct stat dir_stat;
+  if(mkdir(dir, 0777) != 0 && (stat(dir, &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode)))
+  {
+    fprintf(stderr, "Could not create cache directory '%s', results are not cached\n", dir);
+    cache.dir = 0;
+  }
+
+  return cache;
+}
+
+internal b32 str_before(str_t a, str_t b)
+{
+  size_t idx = 0;
+  while(idx < a.size && idx < b.size && a.data[idx] == b.data[idx])
+  {
+    ++idx;
+  }
+  return (idx < a.size && idx < b.size) ? a.data[idx] < b.data[idx] : a.size < b.size;
+}
+
+internal void append_bytes(u8* buffer, size_t* size, void* data, size_t data_size)
+{
+  for(size_t idx = 0;
+      idx < data_size;
+      ++idx)
+  {
+    buffer[(*size)++] = ((u8*)data)[idx];
+  }
+}
+
+// Excluded words sorted and deduplicated, each followed by a space.
+internal str_t canonical_excludes(arena_t* arena, str_t space_separated_must_exclude)
+{
+  str_t result = {0};
+
+  u32 exclude_count = 0;
+  wordlink_t* excluded_words = parse_excluded_words(arena, space_separated_must_exclude);
+  for(wordlink_t* word_link = excluded_words;
+      word_link;
+      word_link = word_link->next)
+  {
+    ++exclude_count;
+  }
+
+  str_t* excludes = alloc_array(arena, exclude_count, str_t);
+  u8* buffer = alloc_array(arena, space_separated_must_exclude.size + 1, u8);
+  if((excludes || exclude_count == 0) && buffer)
+  {
+    u32 count = 0;
+    for(wordlink_t* word_link = excluded_words;
+        word_link;
+        word_link = word_link->next)
+    {
+      u32 insert_idx = count;
+      for(;
+          insert_idx > 0 && str_before(word_link->word, excludes[insert_idx - 1]);
+          --insert_idx)
+      {
+        excludes[insert_idx] = excludes[insert_idx - 1];
+      }
+      excludes[insert_idx] = word_link->word;
+      ++count;
+    }
+
+    for(u32 exclude_idx = 0;
+        exclude_idx < count;
+        ++exclude_idx)
+    {
+      if(exclude_idx == 0 || !str_eq(excludes[exclude_idx], excludes[exclude_idx - 1]))
+      {
+        append_bytes(buffer, &result.size, excludes[exclude_idx].data, excludes[exclude_idx].size);
+        append_bytes(buffer, &result.size, " ", 1);
+      }
+    }
+    result.data = buffer;
+  }
+
+  return result;
+}
+
+// Everything that decides a one-shot query's output.
+internal str_t canonical_query(arena_t* arena, breakdown_t* input_breakdown, i32 wildcards,
+    str_t must_include, str_t space_separated_must_exclude, u32 enabled_dictionaries)
+{
+  str_t result = {0};
+
+  str_t excludes = canonical_excludes(arena, space_separated_must_exclude);
+  size_t max_size = sizeof(*input_breakdown) + 4 * sizeof(u32) + must_include.size + excludes.size;
+  u8* buffer = alloc_array(arena, max_size, u8);
+  if(excludes.data && buffer)
+  {
+    u32 header[] = {(u32)wildcards, enabled_dictionaries, global_search_engine,
+      (u32)must_include.size};
+    append_bytes(buffer, &result.size, input_breakdown, sizeof(*input_breakdown));
+    append_bytes(buffer, &result.size, header, sizeof(header));
+    append_bytes(buffer, &result.size, must_include.data, must_include.size);
+    append_bytes(buffer, &result.size, excludes.data, excludes.size);
+    result.data = buffer;
+  }
+
+  return result;
+}
+
+internal void get_result_cache_path(result_cache_t* cache, str_t query,
+    char path[MAX_RESULT_CACHE_PATH])
+{
+  u64 hash = hash_bytes(cache->dictionary_hash, query.data, query.size);
+  snprintf(path, MAX_RESULT_CACHE_PATH, "%s/%016" PRIx64 ".res", cache->dir, hash);
+}
+
+// Word IDs are offsets into the dictionary texts, one after the other.
+internal u32 cached_word_id(result_cache_t* cache, str_t word, b32* valid)
+{
+  u64 offset = 0;
+  *valid = false;
+  for(u32 source_idx = 0;
+      source_idx < cache->source_count && !*valid;
+      ++source_idx)
+  {
+    str_t text = cache->sources[source_idx].text;
+    if(word.data >= text.data && word.data < text.data + text.size)
+    {
+      offset += (u64)(word.data - text.data);
+      *valid = (offset <= U32_MAX);
+    }
+    else
+    {
+      offset += text.size;
+    }
+  }
+  return (u32)offset;
+}
+
+// Words end at the next line break, as when loading.
+internal str_t cached_word(result_cache_t* cache, u32 id)
+{
+  str_t word = {0};
+  u64 offset = id;
+  for(u32 source_idx = 0;
+      source_idx < cache->source_count && !word.data;
+      ++source_idx)
+  {
+    str_t text = cache->sources[source_idx].text;
+    if(offset < text.size)
+    {
+      word.data = text.data + offset;
+      while(offset + word.size < text.size && !is_linebreak(word.data[word.size]))
+      {
+        ++word.size;
+      }
+    }
+    else
+    {
+      offset -= text.size;
+    }
+  }
+  return word;
+}
+
+// Gives up on caching the query, handing the IDs' memory back to the arena's budget.
+internal void stop_recording(result_record_t* record, arena_t* arena)
+{
+  if(arena->max_capacity)
+  {
+    arena->max_capacity += record->id_capacity * sizeof(u32);
+  }
+  free(record->ids);
+  record->ids = 0;
+  record->id_count = 0;
+  record->id_capacity = 0;
+  record->cacheable = false;
+}
+
+// The IDs are taken out of the same memory budget as the arena, and recording
+// stops once the file would be too big for the cache anyway.
+internal void record_result(result_record_t* record, arena_t* arena, wordlink_t** links,
+    u32 word_count)
+{
+  if(record && record->cacheable)
+  {
+    u64 needed_count = record->id_count + 1 + word_count;
+    if(record->header_size + needed_count * sizeof(u32) > record->cache->max_size)
+    {
+      stop_recording(record, arena);
+    }
+    else if(needed_count > record->id_capacity)
+    {
+      u64 capacity = max(1024, 2 * needed_count);
+      size_t added_size = (capacity - record->id_capacity) * sizeof(u32);
+      u32* ids = 0;
+      if(!arena->max_capacity || arena->max_capacity >= arena->total_capacity + added_size)
+      {
+        ids = realloc(record->ids, capacity * sizeof(u32));
+      }
+
+      if(ids)
+      {
+        if(arena->max_capacity)
+        {
+          arena->max_capacity -= added_size;
+        }
+        record->ids = ids;
+        record->id_capacity = capacity;
+      }
+      else
+      {
+        stop_recording(record, arena);
+      }
+    }
+
+    if(record->cacheable)
+    {
+      record->ids[record->id_count++] = word_count;
+      for(u32 word_idx = 0;
+          word_idx < word_count && record->cacheable;
+          ++word_idx)
+      {
+        record->ids[record->id_count++] = cached_word_id(record->cache, links[word_idx]->word,
+            &record->cacheable);
+      }
+      ++record->result_count;
+    }
+  }
+}
+
+// Prints the results like list_anagrams_for, if the query is cached.
+internal b32 print_cached_results(result_cache_t* cache, str_t query, str_t must_include)
+{
+  b32 hit = false;
+  char path[MAX_RESULT_CACHE_PATH];
+  get_result_cache_path(cache, query, path);
+
+  int fd = open(path, O_RDONLY);
+  struct stat file_stat;
+  if(fd != -1 && fstat(fd, &file_stat) == 0 && (size_t)file_stat.st_size >= sizeof(result_cache_header_t))
+  {
+    size_t file_size = (size_t)file_stat.st_size;
+    u8* data = mmap(0, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data != MAP_FAILED)
+    {
+      result_cache_header_t* header = (result_cache_header_t*)data;
+      size_t ids_start = (sizeof(*header) + header->query_size + 3) & ~(size_t)3;
+      hit = (header->magic == RESULT_CACHE_MAGIC && header->version == RESULT_CACHE_VERSION &&
+          header->dictionary_hash == cache->dictionary_hash &&
+          header->query_size == query.size && ids_start <= file_size &&
+          header->id_count <= (file_size - ids_start) / sizeof(u32) &&
+          str_eq((str_t){header->query_size, data + sizeof(*header)}, query));
+
+      if(hit)
+      {
+        out_buf_t* out = malloc(sizeof(out_buf_t));
+        if(out)
+        {
+          *out = (out_buf_t){ .file = stdout };
+          u32* ids = (u32*)(data + ids_start);
+          u64 id_idx = 0;
+          while(id_idx < header->id_count)
+          {
+            u32 word_count = ids[id_idx++];
+            out_str(out, str("  "));
+            if(must_include.size > 0)
+            {
+              out_str(out, must_include);
+              out_char(out, ' ');
+            }
+            for(u32 word_idx = 0;
+                word_idx < word_count && id_idx < header->id_count;
+                ++word_idx)
+            {
+              if(word_idx > 0) { out_char(out, ' '); }
+              out_str(out, cached_word(cache, ids[id_idx++]));
+            }
+            out_char(out, '\n');
+          }
+          out_flush(out);
+          free(out);
+
+          // Marks the file as recently used.
+          futimens(fd, 0);
+        }
+        else
+        {
+          hit = false;
+        }
+      }
+      munmap(data, file_size);
+    }
+  }
+  if(fd != -1)
+  {
+    close(fd);
+  }
+
+  return hit;
+}
+
+// Removes the least recently used cache files until the rest fit the size cap.
+internal void evict_cached_results(result_cache_t* cache, arena_t* arena)
+{
+  typedef struct
+  {
+    char name[RESULT_CACHE_NAME_SIZE + 1];
+    u64 size;
+    struct timespec used;
+  } cache_file_t;
+
+  arena_snap_t snap = arena_snap(arena);
+  DIR* dir = opendir(cache->dir);
+  if(dir)
+  {
+    u32 file_count = 0;
+    u32 file_capacity = 0;
+    cache_file_t* files = 0;
+    u64 total_size = 0;
+
+    for(struct dirent* entry = readdir(dir);
+        entry;
+        entry = readdir(dir))
+    {
+      str_t name = wrap_str(entry->d_name);
+      char path[MAX_RESULT_CACHE_PATH];
+      struct stat file_stat;
+      snprintf(path, sizeof(path), "%s/%s", cache->dir, entry->d_name);
+      if(name.size == RESULT_CACHE_NAME_SIZE &&
+          str_eq((str_t){4, name.data + RESULT_CACHE_NAME_SIZE - 4}, str(".res")) &&
+          stat(path, &file_stat) == 0 && S_ISREG(file_stat.st_mode))
+      {
+        if(file_count == file_capacity)
+        {
+          // Arrays in the arena only grow by copying.
+          file_capacity = max(64, 2 * file_capacity);
+          cache_file_t* new_files = alloc_array(arena, file_capacity, cache_file_t);
+          if(!new_files) { break; }
+          for(u32 file_idx = 0;
+              file_idx < file_count;
+              ++file_idx)
+          {
+            new_files[file_idx] = files[file_idx];
+          }
+          files = new_files;
+        }
+
+        cache_file_t* file = files + file_count++;
+        for(u32 char_idx = 0;
+            char_idx <= RESULT_CACHE_NAME_SIZE;
+            ++char_idx)
+        {
+          file->name[char_idx] = entry->d_name[char_idx];
+        }
+        file->size = (u64)file_stat.st_size;
+        file->used = file_stat.st_mtim;
+        total_size += file->size;
+      }
+    }
+    closedir(dir);
+
+    while(total_size > cache->max_size && file_count > 0)
+    {
+      u32 oldest_idx = 0;
+      for(u32 file_idx = 1;
+          file_idx < file_count;
+          ++file_idx)
+      {
+        struct timespec a = files[file_idx].used;
+        struct timespec b = files[oldest_idx].used;
+        if(a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec))
+        {
+          oldest_idx = file_idx;
+        }
+      }
+
+      char path[MAX_RESULT_CACHE_PATH];
+      snprintf(path, sizeof(path), "%s/%s", cache->dir, files[oldest_idx].name);
+      unlink(path);
+      total_size -= files[oldest_idx].size;
+      files[oldest_idx] = files[--file_count];
+    }
+  }
+  arena_restore(snap);
+}
+
+// Writes the recorded results to a temporary file and renames it into place.
+internal void store_cached_results(result_record_t* record, str_t query, arena_t* arena)
+{
+  result_cache_t* cache = record->cache;
+  result_cache_header_t header = {
+    .magic = RESULT_CACHE_MAGIC,
+    .version = RESULT_CACHE_VERSION,
+    .dictionary_hash = cache->dictionary_hash,
+    .query_size = (u32)query.size,
+    .result_count = record->result_count,
+    .id_count = record->id_count,
+  };
+  u64 file_size = sizeof(header) + ((query.size + 3) & ~(size_t)3) + record->id_count * sizeof(u32);
+
+  char path[MAX_RESULT_CACHE_PATH];
+  char tmp_path[MAX_RESULT_CACHE_PATH + 32];
+  get_result_cache_path(cache, query, path);
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+  if(file_size <= cache->max_size)
+  {
+    FILE* file = fopen(tmp_path, "wb");
+    if(file)
+    {
+      u8 padding[4] = {0};
+      b32 written = (fwrite(&header, sizeof(header), 1, file) == 1 &&
+          fwrite(query.data, 1, query.size, file) == query.size &&
+          fwrite(padding, 1, (4 - query.size % 4) % 4, file) == (4 - query.size % 4) % 4 &&
+          fwrite(record->ids, sizeof(u32), record->id_count, file) == record->id_count);
+      written &= (fclose(file) == 0);
+
+      if(written && rename(tmp_path, path) == 0)
+      {
+        evict_cached_results(cache, arena);
+      }
+      else
+      {
+        unlink(tmp_path);
+      }
+    }
+  }
+}
+
+// Prints the per-word anagram combinations of a chain of subkeys.
+internal stop_reason_t print_chain_results(arena_t* arena, subkey_t** chain, u32 chain_length,
+    str_t must_include, i32 max_results, i32* result_count, search_stats_t* stats,
+    result_record_t* record)
+{
+  stop_reason_t stop_reason = STOP_NONE;
+  arena_snap_t snap = arena_snap(arena);
+
+  wordlink_t** tmp_links = alloc_array(arena, chain_length, wordlink_t*);
+  if(!tmp_links)
+  {
+    stop_reason = STOP_MEMORY;
+  }
+  for(u32 link_idx = 0;
+      link_idx < chain_length && tmp_links;
+      ++link_idx)
+  {
+    tmp_links[link_idx] = &chain[link_idx]->first_word;
+  }
+
+  while(tmp_links && (max_results < 0 || *result_count < max_results))
+  {
+    printf("  ");
+    if(must_include.size > 0)
+    {
+      printf("%.*s ", (int)must_include.size, must_include.data);
+    }
+
+    for(u32 link_idx = 0;
+        link_idx < chain_length;
+        ++link_idx)
+    {
+      str_t word = tmp_links[link_idx]->word;
+
+      if(link_idx > 0) { printf(" "); }
+      printf("%.*s", (int)word.size, word.data);
+    }
+    printf("\n");
+    record_result(record, arena, tmp_links, chain_length);
+
+    ++*result_count;
+    stat_add(stats, results, 1);
+
+    // Go to next per-word anagram permutation.
+    tmp_links[0] = tmp_links[0]->next;
+    for(u32 link_idx = 0;
+        link_idx < chain_length - 1;
+        ++link_idx)
+    {
+      if(!tmp_links[link_idx])
+      {
+        tmp_links[link_idx] = &chain[link_idx]->first_word;
+        tmp_links[link_idx + 1] = tmp_links[link_idx + 1]->next;
+      }
+    }
+    if(!tmp_links[chain_length - 1])
+    {
+      break;
+    }
+  }
+
+  arena_restore(snap);
+  return stop_reason;
+}
+
+typedef enum
+{
+  ANAGRAM_QUERY_SEARCH,
+  ANAGRAM_QUERY_ADDITIONS,     // The input lacks letters of must_include.
+  ANAGRAM_QUERY_ONLY_INCLUDE,  // must_include uses up the input.
+} anagram_query_kind_t;
+
+// What a query's results depend on, once must_include is taken out of the input.
+typedef struct
+{
+  anagram_query_kind_t kind;
+  breakdown_t letters;
+  i32 wildcards;
+  u32 enabled_dictionaries;
+} anagram_query_t;
+
+internal anagram_query_t reduce_anagram_query(breakdown_t* input_breakdown, i32 wildcards,
+    breakdown_t* must_include_breakdown, u32 enabled_dictionaries)
+{
+  anagram_query_t query = {0};
+  query.enabled_dictionaries = enabled_dictionaries;
+
+  breakdown_t reduced_input_breakdown = *input_breakdown;
+  breakdown_subtract(&reduced_input_breakdown, must_include_breakdown);
+  i32 include_deficit = breakdown_deficit(&reduced_input_breakdown);
+  b32 must_include_is_valid = (include_deficit <= wildcards);
+  if(must_include_is_valid)
+  {
+    breakdown_max0(&reduced_input_breakdown);
+    wildcards -= include_deficit;
+  }
+
+  if(!must_include_is_valid)
+  {
+    // Suggest words to add to the input.
+    breakdown_t missing_letters = *must_include_breakdown;
+    breakdown_subtract(&missing_letters, input_breakdown);
+    breakdown_max0(&missing_letters);
+
+    query.kind = ANAGRAM_QUERY_ADDITIONS;
+    query.letters = missing_letters;
+  }
+  else if(!breakdown_is_empty(must_include_breakdown)
+      && breakdown_is_empty(&reduced_input_breakdown) && wildcards == 0)
+  {
+    query.kind = ANAGRAM_QUERY_ONLY_INCLUDE;
+  }
+  else
+  {
+    query.kind = ANAGRAM_QUERY_SEARCH;
+    query.letters = reduced_input_breakdown;
+    query.wildcards = wildcards;
+  }
+
+  return query;
+}
+
+// Prints results as they are found. Returns why the search ended early, if it did.
+internal stop_reason_t list_anagrams_for(hashtable_t* hashtable, arena_t* arena,
+    breakdown_t input_breakdown, i32 wildcards, str_t must_include,
+    str_t space_separated_must_exclude, u32 enabled_dictionaries, i32 max_results,
+    query_limits_t* limits, search_stats_t* stats, result_record_t* record)
+{
+  stop_reason_t stop_reason = STOP_NONE;
+  u64 deadline = limits->timeout_ns ? get_nanoseconds() + limits->timeout_ns : 0;
+  size_t previous_max_capacity = begin_arena_budget(arena, limits);
+
+  breakdown_t must_include_breakdown = breakdown_word(must_include);
+  anagram_query_t query = reduce_anagram_query(&input_breakdown, wildcards, &must_include_breakdown,
+      enabled_dictionaries);
+  breakdown_t reduced_input_breakdown = query.letters;
+  wildcards = query.wildcards;
+
+  if(query.kind == ANAGRAM_QUERY_ADDITIONS)
+  {
+    breakdown_t missing_letters = query.letters;
+    printf("Missing %d letters:\n", breakdown_sum(&missing_letters));
+    for(u32 breakdown_idx = 0;
+        breakdown_idx < array_count(missing_letters.counts);
+        ++breakdown_idx)
+    {
+      i8 count = missing_letters.counts[breakdown_idx];
+      if(count != 0)
+      {
+        printf("  %dx '", (int)count);
+        print_letter(breakdown_idx);
+        printf("'\n");
+      }
+    }
+
+    printf("\nPossible additions:\n");
+    stop_reason = list_anagrams_for(hashtable, arena, missing_letters, 0, str(""), str(""),
+        enabled_dictionaries, 20, limits, stats, 0);
+    if(record) { record->cacheable = false; }
+  }
+  else if(query.kind == ANAGRAM_QUERY_ONLY_INCLUDE)
+  {
+    printf("  %.*s\n", (int)must_include.size, must_include.data);
+    if(record) { record->cacheable = false; }
+  }
+  else
+  {
+    stat_time_var(collect_start);
+    wordlink_t* excluded_words = parse_excluded_words(arena, space_separated_must_exclude);
+    subkey_t* subkeys = collect_subkeys(hashtable, arena, &reduced_input_breakdown, wildcards,
+        excluded_words, enabled_dictionaries);
+    stat_time_var(search_start);
+    stat_add(stats, collect_ns, search_start - collect_start);
 
 #if 0
     printf("Subkeys:\n");
-    for(keylink_t* subkey = subkeys;
+    for(subkey_t* subkey = subkeys;
         subkey;
         subkey = subkey->next)
     {
@@ -459,479 +3886,879 @@ internal void list_anagrams_for(hashtable_t* hashtable, arena_t* arena,
     printf("\n");
 #endif
 
-    if(subkeys)
+    search_t* search = subkeys ? begin_search(arena, subkeys, &reduced_input_breakdown, wildcards,
+        stats) : 0;
+    i32 result_count = 0;
+    while(search && search->status != SEARCH_DONE && !stop_reason &&
+        (max_results < 0 || result_count < max_results))
     {
-      u32 chain_max_length = max(1, breakdown_sum(&input_breakdown));
-      u32 chain_length = 0;
-      keylink_t** chain = alloc_array(arena, chain_max_length, keylink_t*);
+      if(next_combination(search, DEADLINE_CHECK_INTERVAL, stats) == SEARCH_FOUND)
+      {
+        stat_time_var(output_start);
+        stop_reason = print_chain_results(arena, search->chain, search->chain_length, must_include,
+            max_results, &result_count, stats, record);
+        stat_time_var(output_end);
+        // Output is taken back out of the search time added below.
+        stat_add(stats, output_ns, output_end - output_start);
+        stat_add(stats, search_ns, output_start - output_end);
+      }
 
-      breakdown_t remaining_breakdown = reduced_input_breakdown;
-      chain[chain_length++] = subkeys;
-      keylink_t* next_min_subkey = chain[chain_length - 1];
-      b32 no_underflow = breakdown_subtract(&remaining_breakdown, &subkeys->key);
-      assert(no_underflow);
+      if(!stop_reason && check_search_control(limits->control, search))
+      {
+        stop_reason = STOP_CANCELLED;
+      }
 
-      i32 result_count = 0;
-      while(chain_length > 0 && (max_results < 0 || result_count < max_results))
+      if(deadline && get_nanoseconds() > deadline)
       {
-        if(breakdown_is_empty(&remaining_breakdown))
-        {
-          // Print results, with per-word anagram combinations.
-          arena_snap_t snap = arena_snap(arena);
+        stop_reason = STOP_DEADLINE;
+      }
+    }
 
-          wordlink_t** tmp_links = alloc_array(arena, chain_length, wordlink_t*);
-          for(u32 link_idx = 0;
-              link_idx < chain_length;
-              ++link_idx)
-          {
-            tmp_links[link_idx] = &chain[link_idx]->first_word;
-          }
+    if(search && search->status != SEARCH_DONE && !stop_reason)
+    {
+      stop_reason = STOP_MAX_RESULTS;
+    }
 
-          while(max_results < 0 || result_count < max_results)
-          {
-            printf("  ");
-            if(must_include.size > 0)
-            {
-              printf("%.*s ", (int)must_include.size, must_include.data);
-            }
+    stat_time_var(search_end);
+    stat_add(stats, search_ns, search_end - search_start);
+  }
 
-            for(u32 link_idx = 0;
-                link_idx < chain_length;
-                ++link_idx)
-            {
-              str_t word = tmp_links[link_idx]->word;
+  if(arena->out_of_memory)
+  {
+    stop_reason = STOP_MEMORY;
+  }
+  if(record && stop_reason)
+  {
+    record->cacheable = false;
+  }
+  arena->max_capacity = previous_max_capacity;
 
-              if(link_idx > 0) { printf(" "); }
-              printf("%.*s", (int)word.size, word.data);
-            }
-            printf("\n");
+  return stop_reason;
+}
 
-            ++result_count;
+typedef struct
+{
+  u32 count;
+  char** values;
+} counted_args_t;
 
-            // Go to next per-word anagram permutation.
-            tmp_links[0] = tmp_links[0]->next;
-            for(u32 link_idx = 0;
-                link_idx < chain_length - 1;
-                ++link_idx)
-            {
-              if(!tmp_links[link_idx])
-              {
-                tmp_links[link_idx] = &chain[link_idx]->first_word;
-                tmp_links[link_idx + 1] = tmp_links[link_idx + 1]->next;
-              }
-            }
-            if(!tmp_links[chain_length - 1])
-            {
-              break;
-            }
-          }
+internal char* pop_arg(counted_args_t* args)
+{
+  char* result = 0;
+  if(args->count)
+  {
+    result = args->values[0];
+    ++args->values;
+    --args->count;
+  }
+  return result;
+}
 
-          arena_restore(snap);
-        }
+// Modes that follow the options; see main.
+internal b32 is_mode_arg(char* arg)
+{
+  char* modes[] = {"--live", "--repl", "--exact", "--subwords", "--bench", "--groups", "--pairs"};
+  b32 result = false;
+  for(u32 mode_idx = 0;
+      mode_idx < array_count(modes);
+      ++mode_idx)
+  {
+    result |= zstr_eq(arg, modes[mode_idx]);
+  }
+  return result;
+}
+
+// Options followed by a separate value.
+internal b32 is_value_option(char* arg)
+{
+  char* options[] = {"--alphabet", "--dict", "--threads", "--use", "--timeout", "--max-memory",
+    "--undo-limit", "--trace", "--cache"};
+  b32 result = false;
+  for(u32 option_idx = 0;
+      option_idx < array_count(options);
+      ++option_idx)
+  {
+    result |= zstr_eq(arg, options[option_idx]);
+  }
+  return result;
+}
+
+#include "terminal_io.h"
+
+internal void draw_char(char_frame_t* frame, v3u8 fg_col, v3u8 bg_col, i32 x, i32 y, u32 c)
+{
+  if(x >= 0 && y >= 0 && x < frame->width && y < frame->height)
+  {
+    frame->chars[frame->width * y + x] = (color_char_t){fg_col, bg_col, c};
+  }
+}
+
+// Returns the number of characters in str.
+internal i32 draw_str(char_frame_t* frame, v3u8 fg_col, v3u8 bg_col, i32 start_x, i32 y, str_t str)
+{
+  i32 x = start_x;
+  u8* at = str.data;
+  u8* end = str.data + str.size;
+  while(at < end)
+  {
+    u32 c = utf8_decode(&at, end);
+    if(y >= 0 && y < frame->height && x >= 0 && x < frame->width)
+    {
+      draw_char(frame, fg_col, bg_col, x, y, c);
+    }
+    ++x;
+  }
+
+  return x - start_x;
+}
+
+v3u8 black       = {0,0,0};
+v3u8 dark_gray   = {80,80,80};
+v3u8 bright_gray = {140,140,140};
+v3u8 white       = {255,255,255};
+v3u8 dark_red    = {160,0,0};
+v3u8 bright_red  = {255,0,0};
+
+typedef struct anagram_result_t
+{
+  u32 word_count;
+  str_t* words;
+  struct anagram_result_t* next_result;
+} anagram_result_t;
+
+typedef struct
+{
+  arena_t arena;
+
+  u32 result_count;
+  b32 not_done;
+  stop_reason_t stop_reason;
+  anagram_result_t* first_result;
+  anagram_result_t* last_result;
+} anagram_results_t;
+
+typedef struct
+{
+  b32 initialized;
+
+  anagram_query_t query;
+  str_t excludes;  // As by canonical_excludes.
 
-        b32 found_next = false;
-        // Try adding a new chain element.
-        for(keylink_t* next_subkey = next_min_subkey;
-            next_subkey && !found_next;
-            next_subkey = next_subkey->next)
+  arena_t search_arena;  // Candidates and search state.
+  subkey_t* subkeys; // not used at the moment; could visualize
+  search_t* search;
+
+  // When the input lacks letters of must_include, the search is over these
+  // instead, and its results are suggested additions to the input.
+  b32 suggesting_additions;
+  breakdown_t missing_letters;
+
+  // Time is only counted while computing, not while the user looks at results.
+  u64 timeout_ns;
+  search_control_t* control;
+  u64 compute_ns;
+
+  search_stats_t stats;
+  anagram_results_t results;
+} anagram_context_t;
+
+// Returns 0 when the results arena is out of memory.
+internal anagram_result_t* begin_anagram_result(anagram_results_t* results, u32 word_count)
+{
+  anagram_result_t* result = alloc_struct_clear(&results->arena, anagram_result_t);
+  str_t* words = alloc_array_clear(&results->arena, word_count, str_t);
+
+  if(result && (words || word_count == 0))
+  {
+    result->word_count = word_count;
+    result->words = words;
+
+    if(results->last_result)
+    {
+      results->last_result->next_result = result;
+    }
+    else
+    {
+      results->first_result = result;
+    }
+    results->last_result = result;
+    ++results->result_count;
+  }
+  else
+  {
+    result = 0;
+  }
+
+  return result;
+}
+
+internal b32 anagram_query_eq(anagram_query_t* a, anagram_query_t* b)
+{
+  return a->kind == b->kind && breakdown_eq(&a->letters, &b->letters) &&
+    a->wildcards == b->wildcards && a->enabled_dictionaries == b->enabled_dictionaries;
+}
+
+// Sets up the incremental search of compute_anagrams over the given letters.
+internal void begin_anagram_search(anagram_context_t* ctx, hashtable_t* hashtable, arena_t* arena,
+    breakdown_t* letters, i32 wildcards, str_t space_separated_must_exclude,
+    u32 enabled_dictionaries)
+{
+  stat_time_var(collect_start);
+  wordlink_t* excluded_words = parse_excluded_words(arena, space_separated_must_exclude);
+  subkey_t* subkeys = collect_subkeys(hashtable, arena, letters, wildcards,
+      excluded_words, enabled_dictionaries);
+  stat_time_var(collect_end);
+  stat_add(&ctx->stats, collect_ns, collect_end - collect_start);
+
+  ctx->subkeys = subkeys;
+  ctx->search = subkeys ? begin_search(arena, subkeys, letters, wildcards, &ctx->stats) : 0;
+}
+
+internal anagram_context_t begin_anagram_context(hashtable_t* hashtable,
+    breakdown_t* input_breakdown,
+    i32 wildcards,
+    breakdown_t* must_include_breakdown,
+    str_t space_separated_must_exclude,
+    u32 enabled_dictionaries,
+    query_limits_t* limits)
+{
+  u64 trace_start = trace_begin();
+  anagram_context_t ctx = {0};
+  ctx.initialized = true;
+  ctx.search_arena = new_custom_arena(1024 * 1024);
+  ctx.search_arena.max_capacity = limits->memory_budget;
+  ctx.results.arena = new_custom_arena(1024 * 1024);
+  ctx.results.arena.max_capacity = limits->memory_budget;
+  ctx.results.not_done = true;
+  ctx.timeout_ns = limits->timeout_ns;
+  ctx.control = limits->control;
+
+  arena_t* arena = &ctx.search_arena;
+  ctx.query = reduce_anagram_query(input_breakdown, wildcards, must_include_breakdown,
+      enabled_dictionaries);
+  ctx.excludes = canonical_excludes(arena, space_separated_must_exclude);
+
+  if(ctx.query.kind == ANAGRAM_QUERY_ADDITIONS)
+  {
+    ctx.suggesting_additions = true;
+    ctx.missing_letters = ctx.query.letters;
+    begin_anagram_search(&ctx, hashtable, arena, &ctx.query.letters, 0,
+        space_separated_must_exclude, enabled_dictionaries);
+  }
+  else if(ctx.query.kind == ANAGRAM_QUERY_ONLY_INCLUDE)
+  {
+    begin_anagram_result(&ctx.results, 0);
+  }
+  else
+  {
+    begin_anagram_search(&ctx, hashtable, arena, &ctx.query.letters, ctx.query.wildcards,
+        space_separated_must_exclude, enabled_dictionaries);
+  }
+
+  trace_end(trace_start, "begin_anagram_context");
+  return ctx;
+}
+
+internal void end_anagram_context(anagram_context_t* ctx)
+{
+  if(ctx->initialized)
+  {
+    clear_arena(&ctx->search_arena);
+    clear_arena(&ctx->results.arena);
+    ctx->initialized = false;
+  }
+}
+
+internal size_t anagram_context_size(anagram_context_t* ctx)
+{
+  return ctx->search_arena.total_capacity + ctx->results.arena.total_capacity;
+}
+
+// Recent live mode queries, so that undo, redo or typing an input again brings
+// back its candidates and results, or the search where it was left off.
+#define ANAGRAM_CACHE_ENTRIES 16
+#define ANAGRAM_CACHE_MAX_SIZE (256 * 1024 * 1024)
+
+typedef struct
+{
+  u64 use_count;
+  u32 entry_count;
+  u64 last_used[ANAGRAM_CACHE_ENTRIES];
+  anagram_context_t entries[ANAGRAM_CACHE_ENTRIES];
+} anagram_cache_t;
+
+internal void remove_anagram_cache_entry(anagram_cache_t* cache, u32 entry_idx)
+{
+  --cache->entry_count;
+  cache->entries[entry_idx] = cache->entries[cache->entry_count];
+  cache->last_used[entry_idx] = cache->last_used[cache->entry_count];
+}
+
+// Takes the context out of the cache if it is there, or begins a new one.
+internal anagram_context_t begin_cached_anagram_context(anagram_cache_t* cache,
+    hashtable_t* hashtable, arena_t* tmp_arena,
+    breakdown_t* input_breakdown,
+    i32 wildcards,
+    breakdown_t* must_include_breakdown,
+    str_t space_separated_must_exclude,
+    u32 enabled_dictionaries,
+    query_limits_t* limits)
+{
+  anagram_context_t ctx = {0};
+
+  anagram_query_t query = reduce_anagram_query(input_breakdown, wildcards, must_include_breakdown,
+      enabled_dictionaries);
+  arena_snap_t snap = arena_snap(tmp_arena);
+  str_t excludes = canonical_excludes(tmp_arena, space_separated_must_exclude);
+  for(u32 entry_idx = 0;
+      entry_idx < cache->entry_count && !ctx.initialized;
+      ++entry_idx)
+  {
+    anagram_context_t* entry = cache->entries + entry_idx;
+    if(anagram_query_eq(&entry->query, &query) && str_eq(entry->excludes, excludes))
+    {
+      ctx = *entry;
+      remove_anagram_cache_entry(cache, entry_idx);
+    }
+  }
+  arena_restore(snap);
+
+  if(!ctx.initialized)
+  {
+    ctx = begin_anagram_context(hashtable, input_breakdown, wildcards, must_include_breakdown,
+        space_separated_must_exclude, enabled_dictionaries, limits);
+  }
+
+  return ctx;
+}
+
+// Keeps the context for later, dropping the least recently used ones to make
+// room. Searches stopped by a limit are not kept, so they can run again.
+internal void end_cached_anagram_context(anagram_cache_t* cache, anagram_context_t* ctx)
+{
+  size_t size = anagram_context_size(ctx);
+  if(ctx->initialized && !ctx->results.stop_reason && size <= ANAGRAM_CACHE_MAX_SIZE)
+  {
+    size_t total_size = size;
+    for(u32 entry_idx = 0;
+        entry_idx < cache->entry_count;
+        ++entry_idx)
+    {
+      total_size += anagram_context_size(cache->entries + entry_idx);
+    }
+
+    while(cache->entry_count == ANAGRAM_CACHE_ENTRIES || total_size > ANAGRAM_CACHE_MAX_SIZE)
+    {
+      u32 oldest_idx = 0;
+      for(u32 entry_idx = 1;
+          entry_idx < cache->entry_count;
+          ++entry_idx)
+      {
+        if(cache->last_used[entry_idx] < cache->last_used[oldest_idx])
         {
-          breakdown_t* next_key = &next_subkey->key;
-          if(breakdown_contains(&remaining_breakdown, next_key))
-          {
-            assert(chain_length < chain_max_length);
-            chain[chain_length++] = next_subkey;
-            breakdown_subtract(&remaining_breakdown, next_key);
-            found_next = true;
-            next_min_subkey = chain[chain_length - 1];
-          }
+          oldest_idx = entry_idx;
         }
+      }
 
-        if(!found_next)
-        {
-          // Try changing the last chain element.
-          keylink_t* prev_last_subkey = chain[--chain_length];
-          breakdown_add(&remaining_breakdown, &prev_last_subkey->key);
-          for(keylink_t* next_subkey = prev_last_subkey->next;
-              next_subkey && !found_next;
-              next_subkey = next_subkey->next)
-          {
-            breakdown_t* next_key = &next_subkey->key;
-            if(breakdown_contains(&remaining_breakdown, next_key))
-            {
-              assert(chain_length < chain_max_length);
-              chain[chain_length++] = next_subkey;
-              breakdown_subtract(&remaining_breakdown, next_key);
-              found_next = true;
-              next_min_subkey = chain[chain_length - 1];
-            }
-          }
+      total_size -= anagram_context_size(cache->entries + oldest_idx);
+      end_anagram_context(cache->entries + oldest_idx);
+      remove_anagram_cache_entry(cache, oldest_idx);
+    }
 
-          if(!found_next)
-          {
-            next_min_subkey = prev_last_subkey->next;
-          }
-        }
+    cache->entries[cache->entry_count] = *ctx;
+    cache->last_used[cache->entry_count] = ++cache->use_count;
+    ++cache->entry_count;
+    ctx->initialized = false;
+  }
+  else
+  {
+    end_anagram_context(ctx);
+  }
+}
+
+// Adds the per-word anagram combinations of a chain of subkeys to the results.
+internal void store_chain_results(anagram_context_t* ctx, subkey_t** chain, u32 chain_length)
+{
+  arena_t* arena = &ctx->search_arena;
+  arena_snap_t snap = arena_snap(arena);
+
+  wordlink_t** tmp_links = alloc_array(arena, chain_length, wordlink_t*);
+  for(u32 link_idx = 0;
+      link_idx < chain_length && tmp_links;
+      ++link_idx)
+  {
+    tmp_links[link_idx] = &chain[link_idx]->first_word;
+  }
+
+  while(!ctx->results.stop_reason)
+  {
+    anagram_result_t* result = tmp_links ? begin_anagram_result(&ctx->results, chain_length) : 0;
+    if(!result)
+    {
+      ctx->results.stop_reason = STOP_MEMORY;
+      break;
+    }
+    stat_add(&ctx->stats, results, 1);
+
+    for(u32 link_idx = 0;
+        link_idx < chain_length;
+        ++link_idx)
+    {
+      result->words[link_idx] = tmp_links[link_idx]->word;
+    }
+
+    // Go to next per-word anagram permutation.
+    tmp_links[0] = tmp_links[0]->next;
+    for(u32 link_idx = 0;
+        link_idx < chain_length - 1;
+        ++link_idx)
+    {
+      if(!tmp_links[link_idx])
+      {
+        tmp_links[link_idx] = &chain[link_idx]->first_word;
+        tmp_links[link_idx + 1] = tmp_links[link_idx + 1]->next;
       }
     }
+    if(!tmp_links[chain_length - 1])
+    {
+      break;
+    }
   }
+
+  arena_restore(snap);
 }
 
-typedef struct
+internal void compute_anagrams(anagram_context_t* ctx, u32 iterations)
 {
-  u32 count;
-  char** values;
-} counted_args_t;
+  u64 trace_start = trace_begin();
+  arena_t* arena = &ctx->search_arena;
+  u64 start_ns = get_nanoseconds();
+  u64 deadline = ctx->timeout_ns ? start_ns + (ctx->timeout_ns - min(ctx->timeout_ns, ctx->compute_ns)) : 0;
+
+  search_t* search = ctx->search;
+  u64 end_step = search ? search->step_count + iterations : 0;
+  while(search && search->status != SEARCH_DONE && search->step_count < end_step &&
+      !ctx->results.stop_reason)
+  {
+    u32 steps = (u32)min(DEADLINE_CHECK_INTERVAL, end_step - search->step_count);
+    if(next_combination(search, steps, &ctx->stats) == SEARCH_FOUND)
+    {
+      store_chain_results(ctx, search->chain, search->chain_length);
+    }
 
-internal char* pop_arg(counted_args_t* args)
-{
-  char* result = 0;
-  if(args->count)
+    if(!ctx->results.stop_reason && check_search_control(ctx->control, search))
+    {
+      ctx->results.stop_reason = STOP_CANCELLED;
+    }
+
+    if(deadline && get_nanoseconds() > deadline)
+    {
+      ctx->results.stop_reason = STOP_DEADLINE;
+    }
+  }
+
+  b32 searching = (search && search->status != SEARCH_DONE);
+  if(!searching && arena->out_of_memory)
   {
-    result = args->values[0];
-    ++args->values;
-    --args->count;
+    // Candidates were cut short.
+    ctx->results.stop_reason = STOP_MEMORY;
   }
-  return result;
+  u64 slice_ns = get_nanoseconds() - start_ns;
+  ctx->compute_ns += slice_ns;
+  stat_add(&ctx->stats, search_ns, slice_ns);
+  ctx->results.not_done = (searching && !ctx->results.stop_reason);
+  trace_end(trace_start, "compute_anagrams");
 }
 
-#include "terminal_io.h"
-
-internal void draw_char(char_frame_t* frame, v3u8 fg_col, v3u8 bg_col, i32 x, i32 y, u8 c)
+// Fixed queries for --bench, so runs can be compared between versions.
+internal char* benchmark_queries[][2] = {
+  {"short",  "listen"},
+  {"short",  "dormitory"},
+  {"short",  "astronomer"},
+  {"medium", "clint eastwood"},
+  {"medium", "eleven plus two"},
+  {"medium", "the morse code"},
+  {"long",   "william shakespeare"},
+  {"long",   "president of the united states"},
+  {"long",   "the quick brown fox jumps"},
+};
+
+// Searches are cut off after this many steps or results, which keeps long
+// queries bounded while the work stays the same from run to run.
+#define BENCHMARK_MAX_STEPS (5 * 1000 * 1000)
+#define BENCHMARK_MAX_RESULTS 200000
+#define BENCHMARK_STEPS_PER_SLICE 100000
+
+// High-water mark of the whole process, so it only ever grows across queries.
+internal u64 process_peak_rss_kb()
 {
-  if(x >= 0 && y >= 0 && x < frame->width && y < frame->height)
-  {
-    frame->chars[frame->width * y + x] = (color_char_t){fg_col, bg_col, c};
-  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (u64)usage.ru_maxrss;
 }
 
-internal i32 draw_str(char_frame_t* frame, v3u8 fg_col, v3u8 bg_col, i32 start_x, i32 y, str_t str)
+// Resident size right now, to measure what a single query adds.
+internal u64 current_rss_kb()
 {
-  if(y >= 0 && y < frame->height)
+  u64 resident_pages = 0;
+  FILE* file = fopen("/proc/self/statm", "r");
+  if(file)
   {
-    u32 start_i = (u32)max(0, -start_x);
-    for(u32 i = start_i;
-        i < str.size;
-        ++i)
+    if(fscanf(file, "%*u %" SCNu64, &resident_pages) != 1)
     {
-      i32 x = start_x + i;
-      if(x >= frame->width) { break; }
-      draw_char(frame, fg_col, bg_col, x, y, str.data[i]);
+      resident_pages = 0;
     }
+    fclose(file);
   }
-
-  return str.size;
+  return resident_pages * (u64)sysconf(_SC_PAGESIZE) / 1024;
 }
 
-v3u8 black       = {0,0,0};
-v3u8 dark_gray   = {80,80,80};
-v3u8 bright_gray = {140,140,140};
-v3u8 white       = {255,255,255};
-v3u8 dark_red    = {160,0,0};
-v3u8 bright_red  = {255,0,0};
-
-typedef struct anagram_result_t
-{
-  u32 word_count;
-  str_t* words;
-  struct anagram_result_t* next_result;
-} anagram_result_t;
-
-typedef struct
+// Hardware counters of this thread's cache misses, to compare search memory
+// layouts. Many VMs and containers have none; they are printed as null then.
+typedef enum
 {
-  arena_t arena;
+  CACHE_COUNTER_L1D_READ_MISSES,
+  CACHE_COUNTER_LLC_MISSES,
+  CACHE_COUNTER_COUNT,
+} cache_counter_t;
 
-  u32 result_count;
-  b32 not_done;
-  anagram_result_t* first_result;
-  anagram_result_t* last_result;
-} anagram_results_t;
+internal char* cache_counter_names[CACHE_COUNTER_COUNT] = {
+  "l1d_read_misses",
+  "llc_misses",
+};
 
 typedef struct
 {
-  b32 initialized;
-
-  arena_t* tmp_arena;
-  arena_snap_t tmp_arena_snap;
-  keylink_t* subkeys; // not used at the moment; could visualize
-
-  u32 chain_max_length;
-  u32 chain_length;
-  keylink_t** chain;
-
-  breakdown_t remaining_breakdown;
-  keylink_t* next_subkey_to_add;
-
-  anagram_results_t results;
-} anagram_context_t;
+  int fds[CACHE_COUNTER_COUNT];
+} cache_counters_t;
 
-internal anagram_result_t* begin_anagram_result(anagram_results_t* results, u32 word_count)
+internal cache_counters_t open_cache_counters()
 {
-  anagram_result_t* result = alloc_struct_clear(&results->arena, anagram_result_t);
-  result->word_count = word_count;
-  result->words = alloc_array_clear(&results->arena, word_count, str_t);
-
-  if(results->last_result)
-  {
-    results->last_result->next_result = result;
-  }
-  else
+  u64 configs[CACHE_COUNTER_COUNT] = {
+    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+  };
+
+  cache_counters_t counters;
+  for(u32 counter = 0;
+      counter < CACHE_COUNTER_COUNT;
+      ++counter)
   {
-    results->first_result = result;
+    struct perf_event_attr attr = {0};
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = configs[counter];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    counters.fds[counter] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
   }
-  results->last_result = result;
-  ++results->result_count;
 
-  return result;
+  return counters;
 }
 
-internal anagram_context_t begin_anagram_context(hashtable_t* hashtable, arena_t* arena,
-    breakdown_t* input_breakdown,
-    breakdown_t* must_include_breakdown,
-    str_t space_separated_must_exclude)
+internal void start_cache_counters(cache_counters_t* counters)
 {
-  anagram_context_t ctx = {0};
-  ctx.initialized = true;
-  ctx.tmp_arena = arena;
-  ctx.tmp_arena_snap = arena_snap(arena);
-  ctx.results.arena = new_custom_arena(1024 * 1024);
-  ctx.results.not_done = true;
-
-  breakdown_t reduced_input_breakdown = *input_breakdown;
-  b32 must_include_is_valid = breakdown_subtract(&reduced_input_breakdown, must_include_breakdown);
-
-  if(!must_include_is_valid)
+  for(u32 counter = 0;
+      counter < CACHE_COUNTER_COUNT;
+      ++counter)
   {
-    // TODO: Suggest possible words to add, like in list_anagrams_for.
+    if(counters->fds[counter] >= 0)
+    {
+      ioctl(counters->fds[counter], PERF_EVENT_IOC_RESET, 0);
+      ioctl(counters->fds[counter], PERF_EVENT_IOC_ENABLE, 0);
+    }
   }
-  else if(!breakdown_is_empty(must_include_breakdown)
-      && breakdown_is_empty(&reduced_input_breakdown))
+}
+
+// Counts since start_cache_counters are added to totals, or set to -1 if unavailable.
+internal void stop_cache_counters(cache_counters_t* counters, i64* counts)
+{
+  for(u32 counter = 0;
+      counter < CACHE_COUNTER_COUNT;
+      ++counter)
   {
-    begin_anagram_result(&ctx.results, 0);
+    u64 count = 0;
+    if(counters->fds[counter] >= 0 &&
+        ioctl(counters->fds[counter], PERF_EVENT_IOC_DISABLE, 0) == 0 &&
+        read(counters->fds[counter], &count, sizeof(count)) == sizeof(count) &&
+        counts[counter] >= 0)
+    {
+      counts[counter] += (i64)count;
+    }
+    else
+    {
+      counts[counter] = -1;
+    }
   }
-  else
-  {
-    wordlink_t* excluded_words = 0;
+}
 
-    // Separate excluded words by space.
-    for(i32 idx = 0, last_wordstart = 0;
-        idx <= space_separated_must_exclude.size;
-        ++idx)
+internal void print_cache_counts_json(i64* counts)
+{
+  for(u32 counter = 0;
+      counter < CACHE_COUNTER_COUNT;
+      ++counter)
+  {
+    printf("%s\"%s\": ", counter ? ", " : "", cache_counter_names[counter]);
+    if(counts[counter] >= 0)
     {
-      if(idx == space_separated_must_exclude.size ||
-          space_separated_must_exclude.data[idx] == ' ')
-      {
-        i32 size = idx - last_wordstart;
-        if(size > 0)
-        {
-          str_t word = {
-            .size = (u32)size,
-            .data = space_separated_must_exclude.data + last_wordstart,
-          };
-          wordlink_t* new_excluded_word = alloc_struct(arena, wordlink_t);
-          new_excluded_word->word = word;
-          new_excluded_word->next = excluded_words;
-          excluded_words = new_excluded_word;
-        }
-        last_wordstart = idx + 1;
-      }
+      printf("%" PRIi64, counts[counter]);
     }
-
-    // Find words that could fit into the input.
-    keylink_t* subkeys = 0;
-    for(u32 entry_idx = 0;
-        entry_idx < array_count(hashtable->entries);
-        ++entry_idx)
+    else
     {
-      for(keylink_t* key_link = hashtable->entries[entry_idx];
-          key_link;
-          key_link = key_link->next)
-      {
-        if(breakdown_contains(&reduced_input_breakdown, &key_link->key))
-        {
-          wordlink_t* current_wordlink = 0;
-
-          for(wordlink_t* test_wordlink = &key_link->first_word;
-              test_wordlink;
-              test_wordlink = test_wordlink->next)
-          {
-            str_t word = test_wordlink->word;
-
-            b32 excluded = false;
-            for(wordlink_t* excluded_word = excluded_words;
-                excluded_word && !excluded;
-                excluded_word = excluded_word->next)
-            {
-              if(str_eq(word, excluded_word->word))
-              {
-                excluded = true;
-              }
-            }
-
-            if(!excluded)
-            {
-              if(!current_wordlink)
-              {
-                // Insert longest words first.
-                u32 key_sum = breakdown_sum(&key_link->key);
-                keylink_t** subkey = &subkeys;
-                while(*subkey && breakdown_sum(&(*subkey)->key) >= key_sum)
-                {
-                  subkey = &(*subkey)->next;
-                }
-
-                keylink_t* new_subkey = alloc_struct(arena, keylink_t);
-                new_subkey->key = key_link->key;
-                new_subkey->next = *subkey;
-                *subkey = new_subkey;
-                current_wordlink = &new_subkey->first_word;
-              }
-              else
-              {
-                wordlink_t* new_word = alloc_struct(arena, wordlink_t);
-                current_wordlink->next = new_word;
-                current_wordlink = new_word;
-              }
-
-              current_wordlink->word = word;
-              current_wordlink->next = 0;
-            }
-          }
-        }
-      }
+      printf("null");
     }
+  }
+}
 
-    if(subkeys)
+internal void close_cache_counters(cache_counters_t* counters)
+{
+  for(u32 counter = 0;
+      counter < CACHE_COUNTER_COUNT;
+      ++counter)
+  {
+    if(counters->fds[counter] >= 0)
     {
-      u32 chain_max_length = max(1, breakdown_sum(input_breakdown));
-      u32 chain_length = 0;
-      keylink_t** chain = alloc_array(arena, chain_max_length, keylink_t*);
-
-      breakdown_t remaining_breakdown = reduced_input_breakdown;
-      chain[chain_length++] = subkeys;
-      keylink_t* next_subkey_to_add = subkeys;
-      b32 no_underflow = breakdown_subtract(&remaining_breakdown, &subkeys->key);
-      assert(no_underflow);
-
-      ctx.subkeys = subkeys;
-
-      ctx.chain_max_length = chain_max_length;
-      ctx.chain_length = chain_length;
-      ctx.chain = chain;
+      close(counters->fds[counter]);
+    }
+  }
+}
 
-      ctx.remaining_breakdown = remaining_breakdown;
-      ctx.next_subkey_to_add = next_subkey_to_add;
+internal void print_json_str(str_t str)
+{
+  putchar('"');
+  for(size_t idx = 0;
+      idx < str.size;
+      ++idx)
+  {
+    u8 c = str.data[idx];
+    if(c == '"' || c == '\\')
+    {
+      putchar('\\');
+    }
+    if(c >= ' ')
+    {
+      putchar(c);
     }
   }
+  putchar('"');
+}
 
-  return ctx;
+internal f64 seconds_between(u64 start_ns, u64 end_ns)
+{
+  return (f64)(end_ns - start_ns) / 1e9;
 }
 
-internal void end_anagram_context(anagram_context_t* ctx)
+// Rough duration for the live status line, e.g. "1m 20s".
+internal void format_duration(char* txt, size_t size, f64 seconds)
 {
-  if(ctx->initialized)
+  u64 s = (u64)(seconds + 0.5);
+  if(s < 60)
   {
-    arena_restore(ctx->tmp_arena_snap);
-    clear_arena(&ctx->results.arena);
-    ctx->initialized = false;
+    snprintf(txt, size, "%us", (u32)s);
+  }
+  else if(s < 60 * 60)
+  {
+    snprintf(txt, size, "%um %02us", (u32)(s / 60), (u32)(s % 60));
+  }
+  else
+  {
+    snprintf(txt, size, "%uh %02um", (u32)min(s / (60 * 60), 9999), (u32)(s / 60 % 60));
   }
 }
 
-internal void compute_anagrams(anagram_context_t* ctx, u32 iterations)
+// Runs the benchmark corpus through the same phases as live mode: candidate
+// collection, search and output (to /dev/null). Prints JSON.
+internal void run_benchmark(hashtable_t* hashtable, u32 enabled_dictionaries,
+    dictionary_source_t* dictionaries, u32 dictionary_count, u64 load_ns)
 {
-  arena_t* arena = ctx->tmp_arena;
-  u32 chain_max_length = ctx->chain_max_length;
-
-  for(u32 iteration = 0;
-      iteration < iterations && ctx->chain_length > 0;
-      ++iteration)
+  u64 key_count = 0;
+  u64 word_count = 0;
+  for(u32 entry_idx = 0;
+      entry_idx < array_count(hashtable->entries);
+      ++entry_idx)
   {
-    if(ctx->next_subkey_to_add && breakdown_is_empty(&ctx->remaining_breakdown))
+    for(keylink_t* key_link = hashtable->entries[entry_idx];
+        key_link;
+        key_link = key_link->next)
     {
-      // Print results, with per-word anagram combinations.
-      arena_snap_t snap = arena_snap(arena);
+      ++key_count;
+      word_count += key_link->word_count;
+    }
+  }
 
-      wordlink_t** tmp_links = alloc_array(arena, ctx->chain_length, wordlink_t*);
-      for(u32 link_idx = 0;
-          link_idx < ctx->chain_length;
-          ++link_idx)
+  printf("{\n  \"dictionaries\": [");
+  for(u32 dict_idx = 0;
+      dict_idx < dictionary_count;
+      ++dict_idx)
+  {
+    if(dict_idx > 0) { printf(", "); }
+    print_json_str(dictionaries[dict_idx].name);
+  }
+  printf("],\n");
+  printf("  \"engine\": \"%s\",\n", search_engine_names[global_search_engine]);
+  printf("  \"load\": {\"seconds\": %.6f, \"keys\": %" PRIu64 ", \"words\": %" PRIu64
+      ", \"words_per_second\": %.0f, \"rss_kb\": %" PRIu64 "},\n",
+      seconds_between(0, load_ns), key_count, word_count,
+      (f64)word_count / max(seconds_between(0, load_ns), 1e-9), current_rss_kb());
+  printf("  \"queries\": [\n");
+
+  FILE* null_file = fopen("/dev/null", "w");
+  arena_t tmp_arena = new_arena();
+  out_buf_t* out = alloc_struct(&tmp_arena, out_buf_t);
+  *out = (out_buf_t){ .file = null_file ? null_file : stdout };
+  query_limits_t limits = { .memory_budget = DEFAULT_QUERY_MEMORY_BUDGET };
+
+  f64 total_seconds[3] = {0};
+  u64 total_results = 0;
+  cache_counters_t cache_counters = open_cache_counters();
+  i64 total_cache_counts[CACHE_COUNTER_COUNT] = {0};
+  for(u32 query_idx = 0;
+      query_idx < array_count(benchmark_queries);
+      ++query_idx)
+  {
+    str_t query = wrap_str(benchmark_queries[query_idx][1]);
+    breakdown_t input_breakdown = breakdown_word(query);
+    breakdown_t must_include_breakdown = {0};
+
+    // Misses are counted over collecting and searching.
+    i64 cache_counts[CACHE_COUNTER_COUNT] = {0};
+    u64 rss_before_kb = current_rss_kb();
+    start_cache_counters(&cache_counters);
+    u64 collect_start = get_nanoseconds();
+    anagram_context_t ctx = begin_anagram_context(hashtable,
+        &input_breakdown, breakdown_wildcards(query), &must_include_breakdown, str(""),
+        enabled_dictionaries, &limits);
+    u64 search_start = get_nanoseconds();
+    for(u32 step_count = 0;
+        step_count < BENCHMARK_MAX_STEPS && ctx.results.not_done &&
+        ctx.results.result_count < BENCHMARK_MAX_RESULTS;
+        step_count += BENCHMARK_STEPS_PER_SLICE)
+    {
+      compute_anagrams(&ctx, BENCHMARK_STEPS_PER_SLICE);
+    }
+    u64 output_start = get_nanoseconds();
+    stop_cache_counters(&cache_counters, cache_counts);
+    size_t output_size = 0;
+    for(anagram_result_t* result = ctx.results.first_result;
+        result;
+        result = result->next_result)
+    {
+      for(u32 word_idx = 0;
+          word_idx < result->word_count;
+          ++word_idx)
       {
-        tmp_links[link_idx] = &ctx->chain[link_idx]->first_word;
+        if(word_idx > 0) { out_char(out, ' '); }
+        out_str(out, result->words[word_idx]);
+        output_size += result->words[word_idx].size + (word_idx > 0);
       }
+      out_char(out, '\n');
+      ++output_size;
+    }
+    out_flush(out);
+    u64 output_end = get_nanoseconds();
+    u64 rss_after_kb = current_rss_kb();
 
-      for(;;)
-      {
-        anagram_result_t* result = begin_anagram_result(&ctx->results, ctx->chain_length);
-        for(u32 link_idx = 0;
-            link_idx < ctx->chain_length;
-            ++link_idx)
-        {
-          result->words[link_idx] = tmp_links[link_idx]->word;
-        }
-
-        // Go to next per-word anagram permutation.
-        tmp_links[0] = tmp_links[0]->next;
-        for(u32 link_idx = 0;
-            link_idx < ctx->chain_length - 1;
-            ++link_idx)
-        {
-          if(!tmp_links[link_idx])
-          {
-            tmp_links[link_idx] = &ctx->chain[link_idx]->first_word;
-            tmp_links[link_idx + 1] = tmp_links[link_idx + 1]->next;
-          }
-        }
-        if(!tmp_links[ctx->chain_length - 1])
-        {
-          ctx->next_subkey_to_add = 0;
-          break;
-        }
-      }
+    u32 candidate_count = 0;
+    for(subkey_t* subkey = ctx.subkeys;
+        subkey;
+        subkey = subkey->next)
+    {
+      ++candidate_count;
+    }
 
-      arena_restore(snap);
+    f64 phase_seconds[3] = {
+      seconds_between(collect_start, search_start),
+      seconds_between(search_start, output_start),
+      seconds_between(output_start, output_end),
+    };
+    for(u32 phase_idx = 0;
+        phase_idx < array_count(phase_seconds);
+        ++phase_idx)
+    {
+      total_seconds[phase_idx] += phase_seconds[phase_idx];
     }
-    else if(ctx->next_subkey_to_add)
+    total_results += ctx.results.result_count;
+    for(u32 counter = 0;
+        counter < CACHE_COUNTER_COUNT;
+        ++counter)
     {
-      assert(!breakdown_underflowed(&ctx->remaining_breakdown));
-      // Try adding a new chain element.
-      assert(ctx->chain_length < chain_max_length);
-      ctx->chain[ctx->chain_length++] = ctx->next_subkey_to_add;
-      if(breakdown_subtract(&ctx->remaining_breakdown, &ctx->next_subkey_to_add->key))
-      {
-        ctx->next_subkey_to_add = ctx->chain[ctx->chain_length - 1];
-      }
-      else
-      {
-        ctx->next_subkey_to_add = 0;
-      }
+      total_cache_counts[counter] = (cache_counts[counter] >= 0 && total_cache_counts[counter] >= 0) ?
+        total_cache_counts[counter] + cache_counts[counter] : -1;
     }
-    else
+
+    printf("    {\"class\": \"%s\", \"query\": ", benchmark_queries[query_idx][0]);
+    print_json_str(query);
+    printf(", \"candidates\": %u, \"results\": %u, \"complete\": %s,\n",
+        candidate_count, ctx.results.result_count, ctx.results.not_done ? "false" : "true");
+    printf("     \"collect_seconds\": %.6f, \"search_seconds\": %.6f, \"output_seconds\": %.6f,\n",
+        phase_seconds[0], phase_seconds[1], phase_seconds[2]);
+    printf("     \"results_per_second\": %.0f, \"output_bytes\": %zu,\n",
+        (f64)ctx.results.result_count / max(phase_seconds[1], 1e-9), output_size);
+    printf("     \"tmp_arena_peak_bytes\": %zu, \"results_arena_bytes\": %zu, \"rss_growth_kb\": %" PRIu64 ",\n",
+        ctx.search_arena.high_water_used, ctx.results.arena.total_used,
+        (rss_after_kb > rss_before_kb) ? rss_after_kb - rss_before_kb : 0);
+    printf("     \"cache_misses\": {");
+    print_cache_counts_json(cache_counts);
+    printf("},\n");
+    ctx.stats.output_ns = output_end - output_start;
+    printf("     \"stats\": ");
+    print_search_stats_json(stdout, &ctx.stats);
+    printf("}%s\n", (query_idx + 1 < array_count(benchmark_queries)) ? "," : "");
+
+    end_anagram_context(&ctx);
+  }
+
+  printf("  ],\n");
+  printf("  \"totals\": {\"collect_seconds\": %.6f, \"search_seconds\": %.6f, \"output_seconds\": %.6f, "
+      "\"results\": %" PRIu64 ", \"results_per_second\": %.0f, \"process_peak_rss_kb\": %" PRIu64 ", "
+      "\"cache_misses\": {",
+      total_seconds[0], total_seconds[1], total_seconds[2], total_results,
+      (f64)total_results / max(total_seconds[1], 1e-9), process_peak_rss_kb());
+  print_cache_counts_json(total_cache_counts);
+  printf("}}\n");
+  printf("}\n");
+  close_cache_counters(&cache_counters);
+
+  if(null_file)
+  {
+    fclose(null_file);
+  }
+  clear_arena(&tmp_arena);
+}
+
+// Writes the recorded spans as Chrome trace events, for chrome://tracing or Perfetto.
+internal b32 write_trace(char* path)
+{
+  FILE* file = fopen(path, "w");
+  if(file)
+  {
+    trace_log_t* log = &global_trace_log;
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    b32 first_event = true;
+    for(trace_ring_t* ring = log->first_ring;
+        ring;
+        ring = ring->next_ring)
     {
-      // Try changing the last chain element.
-      keylink_t* prev_last_subkey = ctx->chain[--ctx->chain_length];
-      breakdown_add(&ctx->remaining_breakdown, &prev_last_subkey->key);
-      keylink_t* next_subkey = prev_last_subkey->next;
-      if(next_subkey)
-      {
-        breakdown_t* next_key = &next_subkey->key;
-        assert(ctx->chain_length < chain_max_length);
-        ctx->chain[ctx->chain_length++] = next_subkey;
-        if(breakdown_subtract(&ctx->remaining_breakdown, next_key))
-        {
-          ctx->next_subkey_to_add = ctx->chain[ctx->chain_length - 1];
-        }
-        else
-        {
-          ctx->next_subkey_to_add = 0;
-        }
-      }
-      else
+      u64 first_idx = ring->event_count > TRACE_RING_SIZE ? ring->event_count - TRACE_RING_SIZE : 0;
+      for(u64 event_idx = first_idx;
+          event_idx < ring->event_count;
+          ++event_idx)
       {
-        ctx->next_subkey_to_add = 0;
+        trace_event_t* event = ring->events + event_idx % TRACE_RING_SIZE;
+        fprintf(file, "%s\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+            "\"ts\": %.3f, \"dur\": %.3f}",
+            first_event ? "" : ",", event->name, ring->thread_id,
+            (f64)(event->start_ns - log->start_ns) / 1e3, (f64)event->duration_ns / 1e3);
+        first_event = false;
       }
     }
+    fprintf(file, "\n]}\n");
+    fclose(file);
   }
-
-  ctx->results.not_done = (ctx->chain_length > 0);
+  return file != 0;
 }
 
 internal b32 delete_substring(str_t* str, size_t start, size_t count)
@@ -1033,27 +4860,41 @@ typedef struct
   b32 help_visible;
 
   b32 show_debug;
+
+  u32 enabled_dictionaries;
 } ui_state_t;
 
 #define MAX_USER_INPUT_SIZE 1024
 
-typedef struct undo_entry_t
+typedef struct
 {
   ui_state_t ui_state;  // TODO: Leave out unrecorded fields.
 
-  arena_snap_t arena_after_this;
-  
-  struct undo_entry_t* previous;
-  struct undo_entry_t* next;
+  // Strings that did not change share the previous entry's text. Text is
+  // owned by the oldest entry using it, and handed on when that one is dropped.
+  b32 owns_str[UI_STR_COUNT];
 } undo_entry_t;
 
 typedef struct
 {
-  arena_t* arena;
+  u32 max_entries;
+  size_t max_text_size;
+} undo_limits_t;
 
-  undo_entry_t* first_entry;
-  undo_entry_t* current_entry;
-  undo_entry_t* last_entry;
+#define DEFAULT_UNDO_ENTRIES 1000
+#define DEFAULT_UNDO_TEXT_SIZE (1024 * 1024)
+
+// Oldest entries are dropped to stay within the limits.
+typedef struct
+{
+  undo_limits_t limits;
+  undo_entry_t* entries;  // Ring buffer of limits.max_entries.
+
+  // Entry numbers only count up; entry n lives in entries[n % max_entries].
+  u32 first_entry;
+  u32 end_entry;
+  u32 current_entry;
+  size_t text_size;
 } undo_history_t;
 
 internal void scroll_results(ui_state_t* state, i32 scroll_amount)
@@ -1097,19 +4938,57 @@ internal void copy_str_unsafe(str_t src, str_t* dst)
   }
 }
 
+internal undo_entry_t* get_undo_entry(undo_history_t* history, u32 entry_number)
+{
+  return history->entries + (entry_number % history->limits.max_entries);
+}
+
+internal void free_undo_text(undo_history_t* history, undo_entry_t* entry, ui_str_idx_t str_idx)
+{
+  if(entry->owns_str[str_idx])
+  {
+    history->text_size -= entry->ui_state.ui_strs[str_idx].size;
+    free(entry->ui_state.ui_strs[str_idx].data);
+    entry->owns_str[str_idx] = false;
+  }
+}
+
+internal void drop_oldest_undo_entry(undo_history_t* history)
+{
+  assert(history->first_entry < history->end_entry);
+  undo_entry_t* oldest = get_undo_entry(history, history->first_entry);
+  undo_entry_t* next = (history->first_entry + 1 < history->end_entry) ?
+    get_undo_entry(history, history->first_entry + 1) : 0;
+
+  for(ui_str_idx_t str_idx = 0;
+      str_idx < UI_STR_COUNT;
+      ++str_idx)
+  {
+    if(oldest->owns_str[str_idx] && next &&
+        next->ui_state.ui_strs[str_idx].data == oldest->ui_state.ui_strs[str_idx].data)
+    {
+      next->owns_str[str_idx] = true;
+      oldest->owns_str[str_idx] = false;
+    }
+    free_undo_text(history, oldest, str_idx);
+  }
+
+  ++history->first_entry;
+}
+
+// Text is kept with malloc instead of an arena, so the oldest entries can be freed.
 internal b32 record_for_undo(ui_state_t* state, undo_history_t* history)
 {
   b32 do_record = false;
+  b32 empty = (history->first_entry == history->end_entry);
 
-  // TODO: Clear old undo entries if history uses too much memory.
-
-  if(!history->current_entry)
+  if(empty)
   {
     do_record = true;
   }
   else
   {
-    undo_entry_t* previous_entry = history->current_entry;
+    undo_entry_t* previous_entry = get_undo_entry(history, history->current_entry);
     ui_state_t* previous_state = &previous_entry->ui_state;
 
     for(ui_str_idx_t str_idx = 0;
@@ -1122,29 +5001,34 @@ internal b32 record_for_undo(ui_state_t* state, undo_history_t* history)
 
   if(do_record)
   {
-    if(history->current_entry)
+    undo_entry_t* previous_entry = 0;
+    if(!empty)
     {
-      arena_restore(history->current_entry->arena_after_this);
-
-      // Not strictly necessary, but avoid pointing into freed memory.
-      history->current_entry->next = 0;
-      history->last_entry = history->current_entry;
+      // Drop the redo entries.
+      while(history->end_entry > history->current_entry + 1)
+      {
+        undo_entry_t* entry = get_undo_entry(history, --history->end_entry);
+        for(ui_str_idx_t str_idx = 0;
+            str_idx < UI_STR_COUNT;
+            ++str_idx)
+        {
+          free_undo_text(history, entry, str_idx);
+        }
+      }
+      previous_entry = get_undo_entry(history, history->current_entry);
     }
 
-    undo_entry_t* new_entry = alloc_struct_clear(history->arena, undo_entry_t);
-    new_entry->previous = history->current_entry;
-    if(!history->current_entry)
-    {
-      history->first_entry = new_entry;
-      new_entry->previous = 0;
-    }
-    else
+    if(history->end_entry - history->first_entry == history->limits.max_entries)
     {
-      history->current_entry->next = new_entry;
+      if(previous_entry == get_undo_entry(history, history->first_entry))
+      {
+        previous_entry = 0;
+      }
+      drop_oldest_undo_entry(history);
     }
-    history->last_entry = new_entry;
-    history->current_entry = new_entry;
 
+    undo_entry_t* new_entry = get_undo_entry(history, history->end_entry);
+    *new_entry = (undo_entry_t){0};
     new_entry->ui_state = *state;
 
     for(ui_str_idx_t str_idx = 0;
@@ -1154,11 +5038,34 @@ internal b32 record_for_undo(ui_state_t* state, undo_history_t* history)
       str_t src_str = state->ui_strs[str_idx];
       str_t* dst_str = &new_entry->ui_state.ui_strs[str_idx];
 
-      dst_str->data = alloc_array(history->arena, src_str.size, u8);
-      copy_str_unsafe(src_str, dst_str);
+      if(previous_entry && str_eq(src_str, previous_entry->ui_state.ui_strs[str_idx]))
+      {
+        *dst_str = previous_entry->ui_state.ui_strs[str_idx];
+      }
+      else
+      {
+        dst_str->data = (src_str.size > 0) ? malloc(src_str.size) : 0;
+        if(dst_str->data)
+        {
+          copy_str_unsafe(src_str, dst_str);
+          new_entry->owns_str[str_idx] = true;
+          history->text_size += src_str.size;
+        }
+        else
+        {
+          dst_str->size = 0;
+        }
+      }
     }
 
-    new_entry->arena_after_this = arena_snap(history->arena);
+    history->current_entry = history->end_entry++;
+
+    // The newest entry is always kept, whatever its size.
+    while(history->text_size > history->limits.max_text_size &&
+        history->end_entry - history->first_entry > 1)
+    {
+      drop_oldest_undo_entry(history);
+    }
   }
 
   return do_record;
@@ -1183,10 +5090,9 @@ internal b32 undo(ui_state_t* state, undo_history_t* history)
   b32 result = false;
 
   record_for_undo(state, history);
-  if(history->current_entry && history->current_entry->previous)
+  if(history->current_entry > history->first_entry)
   {
-    apply_undo_entry_to_state(state, history->current_entry->previous);
-    history->current_entry = history->current_entry->previous;
+    apply_undo_entry_to_state(state, get_undo_entry(history, --history->current_entry));
     result = true;
   }
 
@@ -1197,17 +5103,20 @@ internal b32 redo(ui_state_t* state, undo_history_t* history)
 {
   b32 result = false;
 
-  if(history->current_entry->next)
+  if(history->current_entry + 1 < history->end_entry)
   {
-    history->current_entry = history->current_entry->next;
-    apply_undo_entry_to_state(state, history->current_entry);
+    apply_undo_entry_to_state(state, get_undo_entry(history, ++history->current_entry));
     result = true;
   }
 
   return result;
 }
 
-internal void go_live(hashtable_t* hashtable)
+// The status line only estimates the time left after this much searching.
+#define LIVE_ETA_MIN_SECONDS 0.5
+
+internal void go_live(hashtable_t* hashtable, u32 enabled_dictionaries, query_limits_t* limits,
+    undo_limits_t* undo_limits)
 {
   terminal_context_t terminal_context;
   begin_terminal_io(&terminal_context);
@@ -1224,12 +5133,15 @@ internal void go_live(hashtable_t* hashtable)
   state->ui_strs[UI_STR_INPUT].data   = input_buf;
   state->ui_strs[UI_STR_INCLUDE].data = include_buf;
   state->ui_strs[UI_STR_EXCLUDE].data = exclude_buf;
+  state->enabled_dictionaries = enabled_dictionaries;
 
-  arena_t undo_arena = new_custom_arena(256 * 1024);
-  undo_history_t* history = alloc_struct_clear(&undo_arena, undo_history_t);
-  history->arena = &undo_arena;
+  undo_history_t* history = alloc_struct_clear(&tmp_arena, undo_history_t);
+  history->limits = *undo_limits;
+  history->limits.max_entries = max(1, history->limits.max_entries);
+  history->entries = alloc_array(&tmp_arena, history->limits.max_entries, undo_entry_t);
 
   anagram_context_t anagram_context = {0};
+  anagram_cache_t* anagram_cache = alloc_struct_clear(&tmp_arena, anagram_cache_t);
   b32 dirty = true;
   b32 inputs_changed = false;
   u32 frame_count = 0;
@@ -1238,7 +5150,9 @@ internal void go_live(hashtable_t* hashtable)
 
   while(!global_quitting)
   {
+    u64 events_trace_start = trace_begin();
     get_terminal_events(&terminal_context, &input, &frame);
+    trace_end(events_trace_start, "get_terminal_events");
     if(global_quitting) { break; }
     v2i mouse_pos = input.mouse_pos;
     b32 left_clicked = went_down(input.btn_mouse_left);
@@ -1255,7 +5169,9 @@ internal void go_live(hashtable_t* hashtable)
     copy_str_unsafe(state->ui_strs[UI_STR_EXCLUDE], &previous_exclude);
     i32 previous_cursor_pos = state->cursor_pos;
     i32 previous_skip_results = state->skip_results;
-    undo_entry_t* previous_current_undo_entry = history->current_entry;
+    u32 previous_enabled_dictionaries = state->enabled_dictionaries;
+    u32 previous_current_undo_entry = history->current_entry;
+    u32 previous_first_undo_entry = history->first_entry;
     for(u32 typed_key_idx = 0;
         typed_key_idx < input.typed_key_count;
         ++typed_key_idx)
@@ -1269,7 +5185,7 @@ internal void go_live(hashtable_t* hashtable)
           if(state->cursor_pos > 0)
           {
             record_for_undo(state, history);
-            --state->cursor_pos;
+            state->cursor_pos = utf8_previous(*active_str, state->cursor_pos);
           }
         } break;
 
@@ -1278,7 +5194,7 @@ internal void go_live(hashtable_t* hashtable)
           if(state->cursor_pos < active_str->size)
           {
             record_for_undo(state, history);
-            ++state->cursor_pos;
+            state->cursor_pos = utf8_advance(*active_str, state->cursor_pos, 1);
           }
         } break;
 
@@ -1407,8 +5323,9 @@ internal void go_live(hashtable_t* hashtable)
           // TODO: record_for_undo if this is the first backspace event in sequence?
           if(state->cursor_pos > 0)
           {
-            --state->cursor_pos;
-            dirty |= delete_substring(active_str, state->cursor_pos, 1);
+            i32 orig_cursor_pos = state->cursor_pos;
+            state->cursor_pos = utf8_previous(*active_str, state->cursor_pos);
+            dirty |= delete_substring(active_str, state->cursor_pos, orig_cursor_pos - state->cursor_pos);
           }
         } break;
 
@@ -1416,7 +5333,8 @@ internal void go_live(hashtable_t* hashtable)
         {
           if(state->cursor_pos < active_str->size)
           {
-            dirty |= delete_substring(active_str, state->cursor_pos, 1);
+            i32 offset = utf8_advance(*active_str, state->cursor_pos, 1) - state->cursor_pos;
+            dirty |= delete_substring(active_str, state->cursor_pos, offset);
           }
         } break;
 
@@ -1450,6 +5368,18 @@ internal void go_live(hashtable_t* hashtable)
           dirty = true;
         } break;
 
+        case KEY_F2:
+        case KEY_F3:
+        case KEY_F4:
+        case KEY_F5:
+        {
+          u32 dict_idx = typed_key - KEY_F2;
+          if(hashtable->dictionary_count > 1 && dict_idx < hashtable->dictionary_count)
+          {
+            state->enabled_dictionaries ^= (1u << dict_idx);
+          }
+        } break;
+
         case KEY_F12:
         {
           state->show_debug = !state->show_debug;
@@ -1512,6 +5442,7 @@ internal void go_live(hashtable_t* hashtable)
       inputs_changed |= !breakdown_eq(&previous_input_breakdown, &input_breakdown);
       inputs_changed |= !breakdown_eq(&previous_include_breakdown, &include_breakdown);
       inputs_changed |= !str_eq(previous_exclude, state->ui_strs[UI_STR_EXCLUDE]);
+      inputs_changed |= (state->enabled_dictionaries != previous_enabled_dictionaries);
     }
 
     dirty |= left_clicked;
@@ -1519,7 +5450,8 @@ internal void go_live(hashtable_t* hashtable)
     dirty |= right_clicked;
     dirty |= (state->cursor_pos != previous_cursor_pos);
     dirty |= (state->skip_results != previous_skip_results);
-    dirty |= (state->show_debug && history->current_entry != previous_current_undo_entry);
+    dirty |= (state->show_debug && (history->current_entry != previous_current_undo_entry ||
+                                    history->first_entry != previous_first_undo_entry));
     dirty |= inputs_changed;
     dirty |= anagram_context.results.not_done;
     if(dirty)
@@ -1540,27 +5472,28 @@ internal void go_live(hashtable_t* hashtable)
 
       if(state->show_debug)
       {
-        b32 current_entry_found = false;
-        u32 current_undo_idx = 0;
-        u32 undo_count = 0;
-        for(undo_entry_t* entry = history->first_entry;
-            entry;
-            entry = entry->next)
+        u32 current_undo_idx = history->current_entry - history->first_entry;
+        u32 undo_count = history->end_entry - history->first_entry;
+
+        size_t cached_size = 0;
+        for(u32 entry_idx = 0;
+            entry_idx < anagram_cache->entry_count;
+            ++entry_idx)
         {
-          if(!current_entry_found && entry == history->current_entry)
-          {
-            current_undo_idx = undo_count;
-            current_entry_found = true;
-          }
-          ++undo_count;
+          cached_size += anagram_context_size(anagram_cache->entries + entry_idx);
         }
 
         u8 txt[256];
         size_t len = snprintf(txt, 256,
-            "Tmp arena: %uK; Results arena: %uM; Undo history: %u/%u, %uK",
+            "Tmp arena: %uK, peak %uK used, %u/%u blocks reused; Search arena: %uK; "
+            "Results arena: %uM; Cached queries: %u, %uM; Undo history: %u/%u, %uK",
             (u32)(tmp_arena.total_capacity / 1024),
+            (u32)(tmp_arena.high_water_used / 1024),
+            tmp_arena.reused_block_count, tmp_arena.reused_block_count + tmp_arena.new_block_count,
+            (u32)(anagram_context.search_arena.total_capacity / 1024),
             (u32)(anagram_context.results.arena.total_capacity / 1024 / 1024),
-            current_undo_idx + 1, undo_count, (u32)(undo_arena.total_capacity / 1024));
+            anagram_cache->entry_count, (u32)(cached_size / 1024 / 1024),
+            current_undo_idx + 1, undo_count, (u32)(history->text_size / 1024));
         str_t str = {len, txt};
         draw_str(&frame, (v3u8){0, 255, 0}, black, 0, frame.height - 1, str);
       }
@@ -1597,14 +5530,18 @@ internal void go_live(hashtable_t* hashtable)
             {
               drawn_str_offset = max(0, min(state->cursor_pos - max_str_size/2, drawn_str_offset));
             }
+            while(drawn_str_offset > 0 && is_utf8_continuation(ui_str->data[drawn_str_offset]))
+            {
+              --drawn_str_offset;
+            }
             drawn_str.data = ui_str->data + drawn_str_offset;
 
             if(pass == 0)
             {
               if(mouse_pos.y >= y - 1 && mouse_pos.y <= y + 1)
               {
-                i32 clicked_at_char = max(0, min((i32)ui_str->size,
-                      mouse_pos.x + drawn_str_offset - start_x));
+                i32 clicked_at_char = (i32)utf8_advance(*ui_str, drawn_str_offset,
+                    mouse_pos.x - start_x);
 
                 if(left_clicked || mouse_left_down)
                 {
@@ -1614,7 +5551,7 @@ internal void go_live(hashtable_t* hashtable)
 
                 if(right_clicked)
                 {
-                  clicked_at_char = min((i32)ui_str->size - 1, clicked_at_char);
+                  clicked_at_char = (i32)utf8_previous(*ui_str, clicked_at_char + 1);
                   if(ui_str->data[clicked_at_char] != ' ')
                   {
                     size_t deletion_start = 0;
@@ -1632,29 +5569,37 @@ internal void go_live(hashtable_t* hashtable)
             {
               draw_str(&frame, white, black, start_x, y + 1, ui_str_labels[ui_str_idx]);
 
+              u8* at = drawn_str.data;
+              u8* end = ui_str->data + ui_str->size;
+              i32 drawn_char_count = 0;
               for(i32 i = 0;
                   i < max_str_size;
                   ++i)
               {
                 i32 x = start_x + i;
-                u8 c = (i < drawn_str.size) ? drawn_str.data[i] : ' ';
+                i32 char_pos = (at - ui_str->data) + max(0, i - drawn_char_count);
+                u32 c = ' ';
+                if(at < end)
+                {
+                  c = utf8_decode(&at, end);
+                  ++drawn_char_count;
+                }
+                u32 k = alphabet_letter(&global_alphabet, c);
 
                 b32 dim = false;
                 b32 warning = false;
                 if(ui_str_idx == UI_STR_INPUT)
                 {
-                  if(is_alpha(c))
+                  if(k < BREAKDOWN_WIDTH)
                   {
-                    u8 k = to_lower(c) - 'a';
                     dim |= (include_remaining.counts[k] > 0);
                     --include_remaining.counts[k];
                   }
                 }
                 else if(ui_str_idx == UI_STR_INCLUDE)
                 {
-                  if(is_alpha(c))
+                  if(k < BREAKDOWN_WIDTH)
                   {
-                    u8 k = to_lower(c) - 'a';
                     warning |= (input_remaining.counts[k] <= 0);
                     --input_remaining.counts[k];
                   }
@@ -1662,7 +5607,7 @@ internal void go_live(hashtable_t* hashtable)
 
                 v3u8 fg_col = warning ? bright_red : (dim ? bright_gray : white);
                 v3u8 bg_col = black;
-                if(active && ((i + drawn_str_offset) != state->cursor_pos))
+                if(active && (char_pos != state->cursor_pos))
                 {
                   fg_col = warning ? dark_red : (dim ? dark_gray : black);
                   bg_col = white;
@@ -1683,13 +5628,15 @@ internal void go_live(hashtable_t* hashtable)
       {
         state->skip_results = 0;
         state->skip_results_target = 0;
-        end_anagram_context(&anagram_context);
+        end_cached_anagram_context(anagram_cache, &anagram_context);
         dirty = true;  // update arena statistics in debug view
 
         breakdown_t input_breakdown = breakdown_word(state->ui_strs[UI_STR_INPUT]);
         breakdown_t must_include_breakdown = breakdown_word(state->ui_strs[UI_STR_INCLUDE]);
-        anagram_context = begin_anagram_context(hashtable, &tmp_arena,
-            &input_breakdown, &must_include_breakdown, state->ui_strs[UI_STR_EXCLUDE]);
+        anagram_context = begin_cached_anagram_context(anagram_cache, hashtable, &tmp_arena,
+            &input_breakdown, breakdown_wildcards(state->ui_strs[UI_STR_INPUT]),
+            &must_include_breakdown, state->ui_strs[UI_STR_EXCLUDE],
+            state->enabled_dictionaries, limits);
 
         inputs_changed = false;
       }
@@ -1703,26 +5650,89 @@ internal void go_live(hashtable_t* hashtable)
       {
         u8 txt[256];
         size_t len = 0;
+        if(anagram_context.suggesting_additions)
+        {
+          len = snprintf(txt, array_count(txt), "Missing \"");
+          breakdown_t* missing = &anagram_context.missing_letters;
+          for(u32 letter_idx = 0;
+              letter_idx < global_alphabet.letter_count && len + 8 < array_count(txt);
+              ++letter_idx)
+          {
+            for(i32 count = 0;
+                count < missing->counts[letter_idx] && len + 8 < array_count(txt);
+                ++count)
+            {
+              len += utf8_encode(global_alphabet.letters[letter_idx], txt + len);
+            }
+          }
+          len += snprintf(txt + len, array_count(txt) - len, "\", ");
+        }
+        char status[96] = "";
+        if(results->stop_reason)
+        {
+          snprintf(status, array_count(status), " (stopped at %s)", stop_reason_names[results->stop_reason]);
+        }
+        else if(results->not_done && anagram_context.search)
+        {
+          // The time left is extrapolated once the search has run for a while.
+          f64 progress = search_progress(anagram_context.search);
+          f64 seconds = (f64)anagram_context.compute_ns / 1e9;
+          size_t status_len = snprintf(status, array_count(status), " (maybe more, %d%% searched",
+              (i32)(progress * 100));
+          if(progress > 0 && seconds >= LIVE_ETA_MIN_SECONDS)
+          {
+            char eta[32];
+            format_duration(eta, array_count(eta), seconds * (1 - progress) / progress);
+            status_len += snprintf(status + status_len, array_count(status) - status_len,
+                ", about %s left", eta);
+          }
+          snprintf(status + status_len, array_count(status) - status_len, ")");
+        }
+        else if(results->not_done)
+        {
+          snprintf(status, array_count(status), " (maybe more)");
+        }
         if(results->result_count > 0)
         {
-          u32 count_len = snprintf(txt, array_count(txt), "%u", (u32)results->result_count);
+          u32 count_len = snprintf(txt + len, array_count(txt) - len, "%u", (u32)results->result_count);
           count_len = max(4, count_len);
-          len = snprintf(txt, array_count(txt), "Results %*u to %*u of %*u%s:",
+          len += snprintf(txt + len, array_count(txt) - len, "%s %*u to %*u of %*u%s:",
+              anagram_context.suggesting_additions ? "possible additions" : "Results",
               count_len, (u32)(state->skip_results + 1),
               count_len, (u32)(max(state->skip_results + 1,
                                    min(results->result_count,
                                        state->skip_results + max(1, visible_anagram_count)))),
-              count_len, (u32)results->result_count, results->not_done ? " (maybe more)" : "");
+              count_len, (u32)results->result_count, status);
         }
         else
         {
-          len = snprintf(txt, array_count(txt), "No results.");
+          len += snprintf(txt + len, array_count(txt) - len, "%s%s.",
+              anagram_context.suggesting_additions ? "no additions found" : "No results",
+              results->stop_reason ? status : "");
         }
         str_t str = {len, txt};
         i32 x = start_x;
         i32 y = anagram_start_y + 1;
         draw_str(&frame, white, black, x, y, str);
       }
+      if(hashtable->dictionary_count > 1)
+      {
+        // Dictionary toggles, right-aligned on the results line.
+        i32 x = end_x;
+        i32 y = anagram_start_y + 1;
+        for(i32 dict_idx = min(4, hashtable->dictionary_count) - 1;
+            dict_idx >= 0;
+            --dict_idx)
+        {
+          b32 enabled = (state->enabled_dictionaries >> dict_idx) & 1;
+          str_t name = hashtable->dictionary_names[dict_idx];
+          u8 txt[64];
+          size_t len = snprintf(txt, array_count(txt), "  F%d %.*s",
+              dict_idx + 2, (int)min(40, name.size), name.data);
+          x -= len;
+          draw_str(&frame, enabled ? white : dark_gray, black, x, y, (str_t){len, txt});
+        }
+      }
       i32 current_y = anagram_start_y + state->skip_results;
       str_t orig_include_str = state->ui_strs[UI_STR_INCLUDE];
       size_t include_deletion_start = 0;
@@ -1734,11 +5744,12 @@ internal void go_live(hashtable_t* hashtable)
         if(current_y <= anagram_start_y)
         {
           i32 current_x = start_x + 2;
-          if(orig_include_str.size > 0)
+          if(orig_include_str.size > 0 && !anagram_context.suggesting_additions)
           {
             if(left_clicked || right_clicked)
             {
-              i32 clicked_at_char = mouse_pos.x - current_x;
+              i32 clicked_at_char = (mouse_pos.x < current_x) ? -1 :
+                (i32)utf8_advance(orig_include_str, 0, mouse_pos.x - current_x);
               if(clicked_at_char >= 0 && clicked_at_char < orig_include_str.size &&
                   orig_include_str.data[clicked_at_char] != ' ' &&
                   mouse_pos.y == current_y)
@@ -1759,13 +5770,17 @@ internal void go_live(hashtable_t* hashtable)
 
             if(word_idx > 0) { current_x += 1; }
 
-            if(mouse_pos.x >= current_x && mouse_pos.x <= current_x + word.size &&
+            if(mouse_pos.x >= current_x && mouse_pos.x <= current_x + utf8_length(word) &&
                 mouse_pos.y == current_y)
             {
               if(left_clicked)
               {
                 // TODO: Defer mouse actions, check that click was not occluded by help.
-                str_t* include_str = state->ui_strs + UI_STR_INCLUDE;
+                // Suggested additions go to the input, results to must_include.
+                ui_str_idx_t target_str_idx = anagram_context.suggesting_additions ? UI_STR_INPUT : UI_STR_INCLUDE;
+                str_t* include_str = state->ui_strs + target_str_idx;
+                str_t orig_target_str = (target_str_idx == UI_STR_INCLUDE) ?
+                  orig_include_str : state->ui_strs[UI_STR_INPUT];
                 if(include_str->size + word.size + 1 <= MAX_USER_INPUT_SIZE)
                 {
                   if(include_str->size > 0 && include_str->data[include_str->size - 1] != ' ')
@@ -1780,8 +5795,8 @@ internal void go_live(hashtable_t* hashtable)
                     include_str->data[include_str->size++] = word.data[char_idx];
                   }
 
-                  if(state->active_ui_str_idx == UI_STR_INCLUDE &&
-                      state->cursor_pos == orig_include_str.size)
+                  if(state->active_ui_str_idx == target_str_idx &&
+                      state->cursor_pos == orig_target_str.size)
                   {
                     state->cursor_pos = include_str->size;
                   }
@@ -1851,6 +5866,20 @@ internal void go_live(hashtable_t* hashtable)
         draw_str(&frame, bright_gray, black, start_x + 2, searching_y, status_str);
       }
 
+      if(state->show_debug)
+      {
+        search_stats_t* stats = &anagram_context.stats;
+        u8 txt[256];
+        size_t len = snprintf(txt, 256,
+            "Search: %" PRIu64 " nodes, %" PRIu64 " checks, %" PRIu64 " fits, %" PRIu64 " backtracks, "
+            "%" PRIu64 " results, depth %u; collect %.1fms, search %.1fms",
+            stats->nodes_visited, stats->containment_checks, stats->subtractions, stats->backtracks,
+            stats->results, stats->max_chain_depth,
+            (f64)stats->collect_ns / 1e6, (f64)stats->search_ns / 1e6);
+        str_t str = {len, txt};
+        draw_str(&frame, (v3u8){0, 255, 0}, black, 0, 0, str);
+      }
+
       if(state->help_expansion > 0)
       {
         str_t help_lines[] = {
@@ -1861,11 +5890,13 @@ internal void go_live(hashtable_t* hashtable)
           str("Scroll, Up/Down, PgUp/PgDn  Scroll through results"),
           str("Ctrl+Home, Ctrl+End         Jump to results start, end"),
           str("Left click on result        Add word to inclusions"),
+          str("Left click on addition      Add word to input"),
           str("Right click on result       Add word to exclusions"),
           str("Right click on input        Delete word"),
           str("Ctrl+U, Ctrl+K              Delete to start, end"),
           str("Ctrl+W, Alt+D               Delete word to left, right"),
           str("Ctrl+Z, Ctrl+Y              Undo, redo"),
+          str("F2 to F5                    Toggle dictionaries"),
         };
 
         i32 help_line_count = array_count(help_lines);
@@ -1917,7 +5948,9 @@ internal void go_live(hashtable_t* hashtable)
         }
       }
 
+      u64 print_trace_start = trace_begin();
       print_frame(&terminal_context, &frame);
+      trace_end(print_trace_start, "print_frame");
 
       ++frame_count;
     }
@@ -1928,62 +5961,416 @@ internal void go_live(hashtable_t* hashtable)
   end_terminal_io(&terminal_context);
 }
 
+// Splits "name=path"; without a name, the file name minus extension is used.
+// The path is returned in text until the file is mapped.
+internal dictionary_source_t parse_dictionary_arg(char* arg)
+{
+  dictionary_source_t result = {0};
+  str_t full = wrap_str(arg);
+
+  size_t name_end = 0;
+  while(name_end < full.size && full.data[name_end] != '=')
+  {
+    ++name_end;
+  }
+
+  if(name_end < full.size)
+  {
+    result.name = (str_t){name_end, full.data};
+    result.text.data = full.data + name_end + 1;
+  }
+  else
+  {
+    size_t name_start = full.size;
+    while(name_start > 0 && full.data[name_start - 1] != '/')
+    {
+      --name_start;
+    }
+    name_end = name_start;
+    while(name_end < full.size && full.data[name_end] != '.')
+    {
+      ++name_end;
+    }
+    result.name = (str_t){name_end - name_start, full.data + name_start};
+    result.text.data = full.data;
+  }
+
+  return result;
+}
+
+// Turns a comma separated list of dictionary names into a bit mask. Returns
+// false if a name is unknown.
+internal b32 parse_dictionary_selection(hashtable_t* hashtable, str_t selection, u32* enabled)
+{
+  b32 all_found = true;
+  *enabled = 0;
+
+  for(size_t idx = 0, last_name_start = 0;
+      idx <= selection.size;
+      ++idx)
+  {
+    if(idx == selection.size || selection.data[idx] == ',')
+    {
+      str_t name = {idx - last_name_start, selection.data + last_name_start};
+      if(name.size > 0)
+      {
+        b32 found = false;
+        for(u32 dict_idx = 0;
+            dict_idx < hashtable->dictionary_count;
+            ++dict_idx)
+        {
+          if(str_eq(name, hashtable->dictionary_names[dict_idx]))
+          {
+            *enabled |= (1u << dict_idx);
+            found = true;
+          }
+        }
+
+        if(!found)
+        {
+          fprintf(stderr, "Unknown dictionary '%.*s'\n", (int)name.size, name.data);
+          all_found = false;
+        }
+      }
+      last_name_start = idx + 1;
+    }
+  }
+
+  return all_found;
+}
+
+static search_control_t global_search_control;
+
+// Ctrl+C stops a one-shot or REPL search; the results found so far and the
+// stats are still printed.
+internal void cancel_search(int signal_number)
+{
+  global_search_control.cancelled = 1;
+}
+
+// Shows a one-shot search's progress on stderr while the results go to a file.
+internal void print_progress(void* data, f64 progress)
+{
+  i32* shown_percent = (i32*)data;
+  i32 percent = (i32)(progress * 100);
+  if(percent != *shown_percent)
+  {
+    fprintf(stderr, "\r%3d%%", percent);
+    *shown_percent = percent;
+  }
+}
+
 int main(int argument_count, char** arguments)
 {
   counted_args_t* args = &(counted_args_t){argument_count, arguments};
   char* progname = pop_arg(args);
+  int exit_code = 0;
 
   b32 include_uppercase = false;
-  if(args->count && zstr_eq(args->values[0], "--upper"))
+  b32 fold_case = false;
+  char* alphabet_name = "en";
+
+  // Each --dict adds a word list, optionally named as --dict name=path.
+  dictionary_source_t dictionaries[MAX_DICTIONARIES];
+  b32 dictionaries_mapped[MAX_DICTIONARIES];
+  u32 dictionary_count = 0;
+
+  u32 load_thread_count = 0;
+  char* dictionary_selection = 0;
+  query_limits_t limits = { .memory_budget = DEFAULT_QUERY_MEMORY_BUDGET };
+  undo_limits_t undo_limits = {
+    .max_entries = DEFAULT_UNDO_ENTRIES,
+    .max_text_size = DEFAULT_UNDO_TEXT_SIZE,
+  };
+
+  // Search counters as JSON on stderr, after each query.
+  b32 print_stats = false;
+
+  // Timeline of loading and live mode frames, written on exit.
+  char* trace_path = 0;
+
+  // Complete one-shot results, kept in a directory up to a size in megabytes, e.g. dir,64.
+  char* cache_dir = 0;
+  u64 cache_size = DEFAULT_RESULT_CACHE_SIZE;
+
+  // Options come before the mode or query, in any order. Anything else starting
+  // with -- is rejected, so that a mistyped limit is never searched for instead.
+  while(args->count && zstr_starts_with(args->values[0], "--") && !is_mode_arg(args->values[0]))
+  {
+    char* option = pop_arg(args);
+    char* value = 0;
+    if(zstr_eq(option, "--upper"))
+    {
+      include_uppercase = true;
+    }
+    else if(zstr_eq(option, "--fold-case"))
+    {
+      fold_case = true;
+    }
+    else if(zstr_eq(option, "--stats"))
+    {
+      print_stats = true;
+#if !SEARCH_STATS
+      fprintf(stderr, "Built without SEARCH_STATS, counters stay zero\n");
+#endif
+    }
+    else if(zstr_starts_with(option, "--engine"))
+    {
+      // Either --engine name or --engine=name.
+      char* engine_name = option + 8;
+      if(*engine_name == '=')
+      {
+        ++engine_name;
+      }
+      else if(*engine_name == 0 && args->count)
+      {
+        engine_name = pop_arg(args);
+      }
+
+      b32 valid = false;
+      for(u32 engine = 0;
+          engine < SEARCH_ENGINE_COUNT;
+          ++engine)
+      {
+        if(zstr_eq(engine_name, search_engine_names[engine]))
+        {
+          global_search_engine = (search_engine_t)engine;
+          valid = true;
+        }
+      }
+      if(!valid)
+      {
+        fprintf(stderr, "Unknown engine '%s' (use chain or cover)\n", engine_name);
+        return 1;
+      }
+    }
+    else if(!is_value_option(option))
+    {
+      fprintf(stderr, "Unknown option '%s'\n", option);
+      return 1;
+    }
+    else if(!(value = pop_arg(args)))
+    {
+      fprintf(stderr, "Option '%s' needs a value\n", option);
+      return 1;
+    }
+    else if(zstr_eq(option, "--alphabet"))
+    {
+      alphabet_name = value;
+    }
+    else if(zstr_eq(option, "--dict"))
+    {
+      if(dictionary_count < MAX_DICTIONARIES)
+      {
+        dictionaries[dictionary_count++] = parse_dictionary_arg(value);
+      }
+      else
+      {
+        fprintf(stderr, "Ignoring '%s': at most %d dictionaries are supported\n",
+            value, MAX_DICTIONARIES);
+      }
+    }
+    else if(zstr_eq(option, "--threads"))
+    {
+      load_thread_count = (u32)atoi(value);
+    }
+    else if(zstr_eq(option, "--use"))
+    {
+      dictionary_selection = value;
+    }
+    else if(zstr_eq(option, "--timeout"))
+    {
+      limits.timeout_ns = (u64)(atof(value) * 1e9);
+    }
+    else if(zstr_eq(option, "--max-memory"))
+    {
+      limits.memory_budget = (size_t)atoll(value) * 1024 * 1024;
+    }
+    else if(zstr_eq(option, "--undo-limit"))
+    {
+      // Entries, optionally followed by kilobytes of text, e.g. 500,256.
+      undo_limits.max_entries = (u32)atoi(value);
+      char* comma = value;
+      while(*comma && *comma != ',')
+      {
+        ++comma;
+      }
+      if(*comma)
+      {
+        undo_limits.max_text_size = (size_t)atoll(comma + 1) * 1024;
+      }
+    }
+    else if(zstr_eq(option, "--trace"))
+    {
+      trace_path = value;
+      start_tracing();
+    }
+    else if(zstr_eq(option, "--cache"))
+    {
+      cache_dir = value;
+      char* comma = cache_dir;
+      while(*comma && *comma != ',')
+      {
+        ++comma;
+      }
+      if(*comma)
+      {
+        *comma = 0;
+        cache_size = (u64)atoll(comma + 1) * 1024 * 1024;
+      }
+    }
+  }
+
+  if(fold_case && !include_uppercase)
+  {
+    fprintf(stderr, "--fold-case needs --upper\n");
+    return 1;
+  }
+  if(!set_alphabet(&global_alphabet, alphabet_name))
   {
-    pop_arg(args);
-    include_uppercase = true;
+    fprintf(stderr, "Invalid alphabet '%s'\n", alphabet_name);
+    return 1;
+  }
+  if(dictionary_count == 0)
+  {
+    dictionaries[dictionary_count++] = parse_dictionary_arg("data/words.txt");
   }
 
-  char* wordfile_path = "data/words.txt";
-  if(args->count >= 2 && zstr_eq(args->values[0], "--dict"))
+  size_t total_dictionary_size = 0;
+  for(u32 dict_idx = 0;
+      dict_idx < dictionary_count;
+      ++dict_idx)
+  {
+    // Paths were stored as the text until now.
+    char* path = (char*)dictionaries[dict_idx].text.data;
+    dictionaries[dict_idx].text = map_file(path, &dictionaries_mapped[dict_idx]);
+    total_dictionary_size += dictionaries[dict_idx].text.size;
+    if(!dictionaries[dict_idx].text.data)
+    {
+      // Already reported; nothing is searched without all requested dictionaries.
+      exit_code = 1;
+    }
+  }
+  if(load_thread_count == 0)
   {
-    pop_arg(args);
-    wordfile_path = pop_arg(args);
+    load_thread_count = default_load_thread_count(total_dictionary_size);
   }
-  str_t wordfile_contents = read_file(wordfile_path);
 
-  arena_t hash_arena = new_arena();
+  arena_t hash_arena = new_huge_page_arena();
 
-  if(wordfile_contents.size)
+  if(!exit_code && total_dictionary_size)
   {
     hashtable_t* hashtable = alloc_struct_clear(&hash_arena, hashtable_t);
 
-    // Build hash.
-    u8* wordfile_past_end = wordfile_contents.data + wordfile_contents.size;
-    u8* cursor = wordfile_contents.data;
-    u8* word_start = cursor;
-    b32 word_valid = true;
-    while(cursor <= wordfile_past_end)
+    for(u32 dict_idx = 0;
+        dict_idx < dictionary_count;
+        ++dict_idx)
+    {
+      if(dictionaries_mapped[dict_idx])
+      {
+        madvise(dictionaries[dict_idx].text.data, dictionaries[dict_idx].text.size,
+            MADV_SEQUENTIAL);
+      }
+    }
+    u64 load_start = get_nanoseconds();
+    load_dictionary(hashtable, &hash_arena, dictionaries, dictionary_count,
+        include_uppercase, fold_case, load_thread_count);
+    u64 load_ns = get_nanoseconds() - load_start;
+    for(u32 dict_idx = 0;
+        dict_idx < dictionary_count;
+        ++dict_idx)
+    {
+      if(dictionaries_mapped[dict_idx])
+      {
+        // Afterwards, words are only touched when printing results.
+        madvise(dictionaries[dict_idx].text.data, dictionaries[dict_idx].text.size,
+            MADV_RANDOM);
+      }
+    }
+
+    u32 enabled_dictionaries = ALL_DICTIONARIES;
+    if(dictionary_selection &&
+        !parse_dictionary_selection(hashtable, wrap_str(dictionary_selection), &enabled_dictionaries))
+    {
+      exit_code = 1;
+    }
+    else if(args->count && zstr_eq(args->values[0], "--exact"))
     {
-      if(cursor == wordfile_past_end || is_linebreak(*cursor))
+      pop_arg(args);
+
+      arena_t exact_arena = new_huge_page_arena();
+      exact_index_t exact_index = build_exact_index(hashtable, &exact_arena);
+
+      if(!exact_index.slot_count)
+      {
+        fprintf(stderr, "Could not build the exact anagram index\n");
+        exit_code = 1;
+      }
+      else if(args->count)
+      {
+        while(args->count)
+        {
+          print_exact_anagrams(&exact_index, wrap_str(pop_arg(args)), enabled_dictionaries);
+        }
+      }
+      else
       {
-        i32 word_length = cursor - word_start;
-        if(word_valid)
+        // One query per line.
+        u8 input[1024];
+        while(fgets((char*)input, sizeof(input), stdin))
         {
-          str_t word = {word_length, word_start};
-          breakdown_t breakdown = breakdown_word(word);
-          if(breakdown_sum(&breakdown) > 0)
+          u8* cursor = input;
+          while(*cursor && !is_linebreak(*cursor))
           {
-            hashtable_add_word(hashtable, &hash_arena, word, &breakdown);
+            ++cursor;
           }
+          print_exact_anagrams(&exact_index, (str_t){cursor - input, input}, enabled_dictionaries);
         }
-        word_valid = true;
-        word_start = cursor + 1;
       }
-      else if(!is_ascii(*cursor) || (!include_uppercase && is_upper(*cursor)))
+    }
+    else if(args->count && zstr_eq(args->values[0], "--subwords"))
+    {
+      pop_arg(args);
+
+      b32 by_score = false;
+      if(args->count && zstr_eq(args->values[0], "--score"))
       {
-        word_valid = false;
+        pop_arg(args);
+        by_score = true;
       }
-      ++cursor;
-    }
 
-    if(args->count && zstr_eq(args->values[0], "--groups"))
+      arena_t tmp_arena = new_arena();
+      out_buf_t* out = alloc_struct(&tmp_arena, out_buf_t);
+      *out = (out_buf_t){ .file = stdout };
+      if(args->count)
+      {
+        str_t input = wrap_str(pop_arg(args));
+        breakdown_t input_breakdown = breakdown_word(input);
+        list_subwords(hashtable, &tmp_arena, out, &input_breakdown, breakdown_wildcards(input),
+            enabled_dictionaries, by_score);
+      }
+      else
+      {
+        // One query per line, answers separated by empty lines.
+        u8 input[1024];
+        while(fgets((char*)input, sizeof(input), stdin))
+        {
+          str_t query = wrap_str((char*)input);
+          breakdown_t input_breakdown = breakdown_word(query);
+          list_subwords(hashtable, &tmp_arena, out, &input_breakdown, breakdown_wildcards(query),
+              enabled_dictionaries, by_score);
+          out_char(out, '\n');
+          out_flush(out);
+        }
+      }
+      out_flush(out);
+    }
+    else if(args->count && zstr_eq(args->values[0], "--bench"))
+    {
+      pop_arg(args);
+      run_benchmark(hashtable, enabled_dictionaries, dictionaries, dictionary_count, load_ns);
+    }
+    else if(args->count && zstr_eq(args->values[0], "--groups"))
     {
       pop_arg(args);
 
@@ -1995,10 +6382,47 @@ int main(int argument_count, char** arguments)
 
       // List words with the most single-word anagrams.
       arena_t tmp_arena = new_arena();
-      list_anagram_groups(hashtable, &tmp_arena, min_word_count);
+      list_anagram_groups(hashtable, &tmp_arena, min_word_count, enabled_dictionaries);
+    }
+    else if(args->count && zstr_eq(args->values[0], "--pairs"))
+    {
+      pop_arg(args);
+
+      u32 max_phrase_letters = DEFAULT_MAX_PHRASE_LETTERS;
+      if(args->count)
+      {
+        max_phrase_letters = (u32)atoi(pop_arg(args));
+      }
+
+      // Phrase letters are added as packed keys.
+      if(max_phrase_letters > PACKED_KEY_MAX_COUNT)
+      {
+        fprintf(stderr, "Phrases can have at most %d letters\n", PACKED_KEY_MAX_COUNT);
+        exit_code = 1;
+      }
+      else
+      {
+        arena_t tmp_arena = new_arena();
+        if(!list_anagram_pairs(hashtable, &tmp_arena, max_phrase_letters, enabled_dictionaries))
+        {
+          fprintf(stderr, "Out of memory, phrases are incomplete.\n");
+          exit_code = 1;
+        }
+      }
     }
     else
     {
+      // Restarted reads keep the REPL waiting at its prompt after a Ctrl+C.
+      struct sigaction handle_int = {
+        .sa_handler = cancel_search,
+        .sa_flags = SA_RESTART,
+      };
+      if(args->count && !zstr_eq(args->values[0], "--live"))
+      {
+        sigaction(SIGINT, &handle_int, 0);
+        limits.control = &global_search_control;
+      }
+
       if(args->count && zstr_eq(args->values[0], "--repl"))
       {
         // Query user.
@@ -2010,7 +6434,7 @@ int main(int argument_count, char** arguments)
           fflush(stdout);
           if(fgets((char*)input, sizeof(input), stdin))
           {
-            cursor = input;
+            u8* cursor = input;
             while(*cursor && !is_linebreak(*cursor))
             {
               ++cursor;
@@ -2021,7 +6445,17 @@ int main(int argument_count, char** arguments)
               str_t word = {word_length, input};
 
               breakdown_t input_breakdown = breakdown_word(word);
-              list_anagrams_for(hashtable, &tmp_arena, input_breakdown, str(""), str(""), 20);
+              search_stats_t stats = {0};
+              global_search_control.cancelled = 0;
+              stop_reason_t stop_reason = list_anagrams_for(hashtable, &tmp_arena, input_breakdown,
+                  breakdown_wildcards(word), str(""), str(""), enabled_dictionaries, 20, &limits, &stats,
+                  0);
+              report_stop_reason(stop_reason);
+              if(print_stats)
+              {
+                print_search_stats_json(stderr, &stats);
+                fprintf(stderr, "\n");
+              }
               clear_arena(&tmp_arena);
             }
           }
@@ -2048,15 +6482,66 @@ int main(int argument_count, char** arguments)
         }
 
         breakdown_t input_breakdown = breakdown_word(input);
+        i32 wildcards = breakdown_wildcards(input);
         arena_t tmp_arena = new_arena();
-        list_anagrams_for(hashtable, &tmp_arena, input_breakdown, must_include, must_exclude, -1);
+        search_stats_t stats = {0};
+
+        // Word IDs are 32-bit offsets into the dictionary texts.
+        result_cache_t cache = {0};
+        result_record_t record = {0};
+        str_t query = {0};
+        if(cache_dir && total_dictionary_size <= U32_MAX)
+        {
+          cache = begin_result_cache(cache_dir, cache_size, dictionaries, dictionary_count,
+              include_uppercase, fold_case);
+          query = canonical_query(&tmp_arena, &input_breakdown, wildcards, must_include,
+              must_exclude, enabled_dictionaries);
+          record = (result_record_t){ .cache = &cache, .cacheable = (query.data && cache.dir),
+            .header_size = sizeof(result_cache_header_t) + ((query.size + 3) & ~(size_t)3) };
+        }
+
+        i32 shown_percent = -1;
+        if(isatty(STDERR_FILENO) && !isatty(STDOUT_FILENO))
+        {
+          global_search_control.report_progress = print_progress;
+          global_search_control.progress_data = &shown_percent;
+        }
+
+        if(!record.cacheable || !print_cached_results(&cache, query, must_include))
+        {
+          stop_reason_t stop_reason = list_anagrams_for(hashtable, &tmp_arena, input_breakdown,
+              wildcards, must_include, must_exclude, enabled_dictionaries, -1,
+              &limits, &stats, record.cacheable ? &record : 0);
+          if(shown_percent >= 0)
+          {
+            fprintf(stderr, "\r    \r");
+          }
+          exit_code = report_stop_reason(stop_reason);
+          if(record.cacheable)
+          {
+            fflush(stdout);
+            store_cached_results(&record, query, &tmp_arena);
+          }
+          free(record.ids);
+          if(print_stats)
+          {
+            print_search_stats_json(stderr, &stats);
+            fprintf(stderr, "\n");
+          }
+        }
       }
       else
       {
-        go_live(hashtable);
+        go_live(hashtable, enabled_dictionaries, &limits, &undo_limits);
       }
     }
   }
 
-  return 0;
+  if(trace_path && !write_trace(trace_path))
+  {
+    fprintf(stderr, "Could not write trace to '%s'\n", trace_path);
+    exit_code = 1;
+  }
+
+  return exit_code;
 }
@@ -64,7 +64,7 @@ typedef struct
 {
   v3u8 fg_col;
   v3u8 bg_col;
-  u8 chr;
+  u32 chr;  // Unicode codepoint.
 } color_char_t;
 
 typedef struct
@@ -186,7 +186,8 @@ internal void print_frame(terminal_context_t* ctx, char_frame_t* frame)
     {
       // Turn non-printable characters to spaces.
       color_char_t col_c = *(color_char_t*)((u8*)(frame->chars + i) + j * frame->pitch);
-      if(col_c.chr < ' ' || col_c.chr > '~')
+      if(col_c.chr < ' ' || (col_c.chr > '~' && col_c.chr < 0xa0) ||
+          (col_c.chr >= 0xd800 && col_c.chr < 0xe000) || col_c.chr > 0x10ffff)
       {
         col_c.chr = ' ';
       }
@@ -303,9 +304,9 @@ internal void print_frame(terminal_context_t* ctx, char_frame_t* frame)
 #endif
         }
 
-        if(screenbuf_size < array_count(screenbuf))
+        if(screenbuf_size + 4 <= array_count(screenbuf))
         {
-          screenbuf[screenbuf_size++] = col_c.chr;
+          screenbuf_size += utf8_encode(col_c.chr, screenbuf + screenbuf_size);
         }
 
         prev_char = col_c;
@@ -438,6 +439,10 @@ enum
   KEY_CTRL_DELETE,
   KEY_ALT_D,
   KEY_F1,
+  KEY_F2,
+  KEY_F3,
+  KEY_F4,
+  KEY_F5,
   KEY_F12,
 };
 
@@ -656,6 +661,10 @@ internal void get_terminal_events(terminal_context_t* ctx, live_input_t* input,
             } escape_code_mappings[] = {
               { "d",     KEY_ALT_D },
               { "OP",    KEY_F1 },
+              { "OQ",    KEY_F2 },
+              { "OR",    KEY_F3 },
+              { "OS",    KEY_F4 },
+              { "[15~",  KEY_F5 },
               { "[A",    KEY_ARROW_UP },
               { "[B",    KEY_ARROW_DOWN },
               { "[C",    KEY_ARROW_RIGHT },
@@ -9,6 +9,7 @@ typedef int16_t i16;
 typedef int32_t i32;
 typedef int64_t i64;
 typedef i32 b32;
+typedef double f64;
 
 #define false 0
 #define true 1
@@ -77,6 +78,16 @@ internal b32 zstr_eq(char* a, char* b)
   return result;
 }
 
+internal b32 zstr_starts_with(char* z, char* prefix)
+{
+  while(*prefix && *z == *prefix)
+  {
+    ++z;
+    ++prefix;
+  }
+  return *prefix == 0;
+}
+
 internal b32 str_eq(str_t a, str_t b)
 {
   b32 result = true;
@@ -99,50 +110,189 @@ internal b32 str_eq(str_t a, str_t b)
   return result;
 }
 
-internal str_t read_file(char* path)
+// Reads until the end, in growing blocks: pipes can't be sized up front.
+internal str_t read_stream(FILE* file, char* path)
+{
+  str_t result = {0};
+  size_t capacity = 0;
+  b32 failed = false;
+
+  for(;;)
+  {
+    if(result.size == capacity)
+    {
+      capacity = max(64 * 1024, 2 * capacity);
+      u8* data = realloc(result.data, capacity);
+      if(!data)
+      {
+        fprintf(stderr, "Could not allocate %lu bytes for file '%s'\n", capacity, path);
+        failed = true;
+        break;
+      }
+      result.data = data;
+    }
+
+    size_t read_size = fread(result.data + result.size, 1, capacity - result.size, file);
+    result.size += read_size;
+    if(read_size == 0)
+    {
+      if(ferror(file))
+      {
+        fprintf(stderr, "Could not read all of file '%s'\n", path);
+        failed = true;
+      }
+      break;
+    }
+  }
+
+  if(failed)
+  {
+    free(result.data);
+    result = (str_t){0};
+  }
+
+  return result;
+}
+
+// Maps a file read-only. Falls back to reading it for things that can't be mapped (pipes etc.).
+internal str_t map_file(char* path, b32* mapped)
 {
   str_t result = {0};
-  FILE* fd = fopen(path, "rb");
-  if(fd == 0)
+  *mapped = false;
+
+  int fd = open(path, O_RDONLY);
+  if(fd == -1)
   {
     fprintf(stderr, "Could not open file '%s' for reading\n", path);
   }
   else
   {
-    if(fseek(fd, 0, SEEK_END) == -1)
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0)
     {
-      fprintf(stderr, "Could not seek to end of file '%s'\n", path);
+      void* data = mmap(0, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(data != MAP_FAILED)
+      {
+        result.size = file_stat.st_size;
+        result.data = data;
+        *mapped = true;
+      }
+    }
+
+    // Reading goes on from the same descriptor, which a pipe needs.
+    FILE* file = *mapped ? 0 : fdopen(fd, "rb");
+    if(file)
+    {
+      result = read_stream(file, path);
+      fclose(file);
     }
     else
     {
-      result.size = ftell(fd);
-      fseek(fd, 0L, SEEK_SET);
-      result.data = malloc(result.size);
-
-      if(!result.data)
-      {
-        fprintf(stderr, "Could not allocate %lu bytes for file '%s'\n", result.size, path);
-      }
-      else if(fread(result.data, 1, result.size, fd) != result.size)
-      {
-        fprintf(stderr, "Could not read all of file '%s'\n", path);
-      }
+      close(fd);
     }
   }
 
-  if(fd)
+  return result;
+}
+
+internal u64 get_nanoseconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u64)now.tv_sec * 1000000000ull + (u64)now.tv_nsec;
+}
+
+// Trace spans go into a ring buffer per thread, keeping the latest
+// TRACE_RING_SIZE events of each. Spans are only recorded after start_tracing.
+#define TRACE_RING_SIZE 65536
+
+typedef struct
+{
+  char* name;
+  u64 start_ns;
+  u64 duration_ns;
+} trace_event_t;
+
+typedef struct trace_ring_t
+{
+  trace_event_t events[TRACE_RING_SIZE];
+  u64 event_count;  // All events recorded, including overwritten ones.
+  u32 thread_id;
+
+  struct trace_ring_t* next_ring;
+} trace_ring_t;
+
+typedef struct
+{
+  pthread_mutex_t mutex;
+  b32 enabled;
+  u64 start_ns;
+  u32 thread_count;
+  trace_ring_t* first_ring;
+} trace_log_t;
+
+static trace_log_t global_trace_log = { PTHREAD_MUTEX_INITIALIZER };
+static _Thread_local trace_ring_t* thread_trace_ring;
+
+internal trace_ring_t* get_trace_ring()
+{
+  trace_ring_t* ring = thread_trace_ring;
+  if(!ring)
   {
-    fclose(fd);
+    ring = calloc(1, sizeof(trace_ring_t));
+    if(ring)
+    {
+      trace_log_t* log = &global_trace_log;
+      pthread_mutex_lock(&log->mutex);
+      ring->thread_id = log->thread_count++;
+      ring->next_ring = log->first_ring;
+      log->first_ring = ring;
+      pthread_mutex_unlock(&log->mutex);
+      thread_trace_ring = ring;
+    }
   }
+  return ring;
+}
 
-  return result;
+// The calling thread becomes thread 0 of the trace.
+internal void start_tracing()
+{
+  global_trace_log.start_ns = get_nanoseconds();
+  global_trace_log.enabled = (get_trace_ring() != 0);
 }
 
+// Returns 0 when tracing is off, which makes the matching trace_end a no-op.
+internal u64 trace_begin()
+{
+  return global_trace_log.enabled ? get_nanoseconds() : 0;
+}
+
+internal void trace_end(u64 start_ns, char* name)
+{
+  trace_ring_t* ring = start_ns ? get_trace_ring() : 0;
+  if(ring)
+  {
+    trace_event_t* event = ring->events + ring->event_count % TRACE_RING_SIZE;
+    event->name = name;
+    event->start_ns = start_ns;
+    event->duration_ns = get_nanoseconds() - start_ns;
+    ++ring->event_count;
+  }
+}
+
+// Blocks of huge-page arenas are mapped directly in multiples of this size.
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// Freed blocks are kept for reuse, up to this many bytes in total.
+#define ARENA_BLOCK_CACHE_CAPACITY (64 * 1024 * 1024)
+#define ARENA_DEFAULT_ALIGNMENT 16
+
 typedef struct arena_block_t
 {
   size_t capacity;
   size_t used;
   void* data;
+  size_t allocated_size;  // Including this header.
+  b32 mapped;
 
   struct arena_block_t* previous_block;
 } arena_block_t;
@@ -151,6 +301,16 @@ typedef struct
 {
   size_t block_size;
   size_t total_capacity;
+  size_t max_capacity;  // 0 for no limit
+  b32 out_of_memory;    // Set when an allocation failed, stays set until cleared.
+  b32 huge_pages;       // Map blocks directly and ask for transparent huge pages.
+
+  // Statistics; used bytes include alignment padding.
+  size_t total_used;
+  size_t high_water_used;
+  size_t high_water_capacity;
+  u32 new_block_count;
+  u32 reused_block_count;
 
   arena_block_t* head;
 } arena_t;
@@ -160,8 +320,20 @@ typedef struct
   arena_t* arena;
   arena_block_t* block;
   size_t used;
+  size_t total_used;
 } arena_snap_t;
 
+// Shared by all arenas (and threads), so blocks are not malloc'ed and freed
+// again on every query.
+typedef struct
+{
+  pthread_mutex_t mutex;
+  arena_block_t* first_block;
+  size_t cached_size;
+} arena_block_cache_t;
+
+static arena_block_cache_t global_arena_block_cache = { PTHREAD_MUTEX_INITIALIZER };
+
 internal arena_t new_custom_arena(size_t block_size)
 {
   arena_t result = {0};
@@ -174,12 +346,114 @@ internal arena_t new_arena()
   return new_custom_arena(8 * 1024 * 1024);
 }
 
+// For big, long-lived data.
+internal arena_t new_huge_page_arena()
+{
+  arena_t result = new_custom_arena(8 * 1024 * 1024);
+  result.huge_pages = true;
+  return result;
+}
+
+internal arena_block_t* get_cached_block(size_t allocated_size, b32 mapped)
+{
+  arena_block_cache_t* cache = &global_arena_block_cache;
+  arena_block_t* result = 0;
+
+  pthread_mutex_lock(&cache->mutex);
+  arena_block_t** block = &cache->first_block;
+  while(*block && !result)
+  {
+    if((*block)->allocated_size == allocated_size && (*block)->mapped == mapped)
+    {
+      result = *block;
+      *block = result->previous_block;
+      cache->cached_size -= allocated_size;
+    }
+    else
+    {
+      block = &(*block)->previous_block;
+    }
+  }
+  pthread_mutex_unlock(&cache->mutex);
+
+  return result;
+}
+
+internal void release_block(arena_block_t* block)
+{
+  arena_block_cache_t* cache = &global_arena_block_cache;
+  b32 cached = false;
+
+  pthread_mutex_lock(&cache->mutex);
+  if(cache->cached_size + block->allocated_size <= ARENA_BLOCK_CACHE_CAPACITY)
+  {
+    block->previous_block = cache->first_block;
+    cache->first_block = block;
+    cache->cached_size += block->allocated_size;
+    cached = true;
+  }
+  pthread_mutex_unlock(&cache->mutex);
+
+  if(!cached)
+  {
+    if(block->mapped)
+    {
+      munmap(block, block->allocated_size);
+    }
+    else
+    {
+      free(block);
+    }
+  }
+}
+
+internal arena_block_t* new_block(size_t capacity, b32 huge_pages, b32* reused)
+{
+  size_t allocated_size = sizeof(arena_block_t) + capacity;
+  if(huge_pages)
+  {
+    // Round the whole mapping up to huge pages, and use the rest as capacity.
+    allocated_size = (allocated_size + ARENA_HUGE_PAGE_SIZE - 1) & ~(size_t)(ARENA_HUGE_PAGE_SIZE - 1);
+  }
+
+  arena_block_t* block = get_cached_block(allocated_size, huge_pages);
+  *reused = (block != 0);
+  if(!block && huge_pages)
+  {
+    void* memory = mmap(0, allocated_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory != MAP_FAILED)
+    {
+#ifdef MADV_HUGEPAGE
+      madvise(memory, allocated_size, MADV_HUGEPAGE);
+#endif
+      block = memory;
+    }
+  }
+  else if(!block)
+  {
+    block = malloc(allocated_size);
+  }
+
+  if(block)
+  {
+    block->allocated_size = allocated_size;
+    block->mapped = huge_pages;
+    block->capacity = allocated_size - sizeof(arena_block_t);
+    block->used = 0;
+    block->data = (void*)(block + 1);
+    block->previous_block = 0;
+  }
+
+  return block;
+}
+
 internal arena_snap_t arena_snap(arena_t* arena)
 {
   arena_block_t* block = arena->head;
   arena_snap_t result = {
     .arena = arena,
     .block = block,
+    .total_used = arena->total_used,
   };
   if(block)
   {
@@ -198,13 +472,14 @@ internal void arena_restore(arena_snap_t snap)
     assert(block);
     arena->total_capacity -= block->capacity;
     arena->head = block->previous_block;
-    free(block);
+    release_block(block);
   }
 
   if(arena->head)
   {
     arena->head->used = snap.used;
   }
+  arena->total_used = snap.total_used;
 }
 
 internal void clear_arena(arena_t* arena)
@@ -214,47 +489,88 @@ internal void clear_arena(arena_t* arena)
     arena_block_t* block = arena->head;
     arena->total_capacity -= block->capacity;
     arena->head = block->previous_block;
-    free(block);
+    release_block(block);
   }
   assert(arena->total_capacity == 0);
+  arena->total_used = 0;
 }
 
-internal void* alloc_bytes(arena_t* arena, size_t size)
+// alignment must be a power of two.
+internal void* alloc_bytes_aligned(arena_t* arena, size_t size, size_t alignment)
 {
   void* result = 0;
 
-  b32 allocate = !arena->head || (arena->head->used + size > arena->head->capacity);
+  size_t padding = 0;
+  if(arena->head)
+  {
+    uintptr_t at = (uintptr_t)arena->head->data + arena->head->used;
+    padding = (alignment - (at & (alignment - 1))) & (alignment - 1);
+  }
+
+  b32 allocate = !arena->head || (arena->head->used + padding + size > arena->head->capacity);
   if(allocate)
   {
+    // Block data starts aligned to ARENA_DEFAULT_ALIGNMENT; bigger alignments may need room to spare.
     size_t default_capacity = arena->block_size;
-    size_t capacity = (size > default_capacity) ? size : default_capacity;
-    arena_block_t* block = malloc(sizeof(arena_block_t) + capacity);
-    if(block)
+    size_t needed = size + ((alignment > ARENA_DEFAULT_ALIGNMENT) ? alignment : 0);
+    size_t capacity = (needed > default_capacity) ? needed : default_capacity;
+    b32 over_budget = false;
+    if(arena->max_capacity)
+    {
+      // The last block within the budget may be smaller than usual.
+      size_t budget_left = (arena->max_capacity > arena->total_capacity) ?
+        arena->max_capacity - arena->total_capacity : 0;
+      capacity = min(capacity, budget_left);
+      over_budget = (needed > capacity);
+    }
+    b32 reused = false;
+    arena_block_t* block = over_budget ? 0 : new_block(capacity, arena->huge_pages, &reused);
+    if(!block)
+    {
+      arena->out_of_memory = true;
+    }
+    else
     {
-      *block = (arena_block_t){
-        .capacity = capacity,
-        .data = (void*)(block + 1),
-        .previous_block = arena->head,
-      };
+      if(arena->max_capacity)
+      {
+        // Rounding up to huge pages must not exceed the budget.
+        block->capacity = min(block->capacity, capacity);
+      }
+      block->previous_block = arena->head;
       arena->head = block;
-      arena->total_capacity += capacity;
+      arena->total_capacity += block->capacity;
+      arena->high_water_capacity = max(arena->high_water_capacity, arena->total_capacity);
+      if(reused)
+      {
+        ++arena->reused_block_count;
+      }
+      else
+      {
+        ++arena->new_block_count;
+      }
+
+      uintptr_t at = (uintptr_t)block->data;
+      padding = (alignment - (at & (alignment - 1))) & (alignment - 1);
     }
   }
 
-  if(arena->head)
+  if(arena->head && arena->head->used + padding + size <= arena->head->capacity)
   {
-    result = arena->head->data + arena->head->used;
-    arena->head->used += size;
+    result = (u8*)arena->head->data + arena->head->used + padding;
+    arena->head->used += padding + size;
+    arena->total_used += padding + size;
+    arena->high_water_used = max(arena->high_water_used, arena->total_used);
   }
 
   return result;
 }
-#define alloc_struct(arena, type) ((type*)alloc_bytes((arena), sizeof(type)))
-#define alloc_array(arena, count, type) ((type*)alloc_bytes((arena), (count) * sizeof(type)))
 
-internal void* alloc_bytes_clear(arena_t* arena, size_t size)
+#define alloc_struct(arena, type) ((type*)alloc_bytes_aligned((arena), sizeof(type), _Alignof(type)))
+#define alloc_array(arena, count, type) ((type*)alloc_bytes_aligned((arena), (count) * sizeof(type), _Alignof(type)))
+
+internal void* alloc_bytes_clear(arena_t* arena, size_t size, size_t alignment)
 {
-  void* result = alloc_bytes(arena, size);
+  void* result = alloc_bytes_aligned(arena, size, alignment);
   if(result)
   {
     u8* bytes = result;
@@ -267,8 +583,8 @@ internal void* alloc_bytes_clear(arena_t* arena, size_t size)
   }
   return result;
 }
-#define alloc_struct_clear(arena, type) ((type*)alloc_bytes_clear((arena), sizeof(type)))
-#define alloc_array_clear(arena, count, type) ((type*)alloc_bytes_clear((arena), (count) * sizeof(type)))
+#define alloc_struct_clear(arena, type) ((type*)alloc_bytes_clear((arena), sizeof(type), _Alignof(type)))
+#define alloc_array_clear(arena, count, type) ((type*)alloc_bytes_clear((arena), (count) * sizeof(type), _Alignof(type)))
 
 internal b32 is_ascii(u8 c)
 {
@@ -323,3 +639,219 @@ internal u8 to_upper(u8 c)
 
   return result;
 }
+
+internal b32 is_utf8_continuation(u8 c)
+{
+  return (c & 0xc0) == 0x80;
+}
+
+// Decodes the UTF-8 sequence at *at and advances past it.
+// Malformed sequences decode byte by byte as U+FFFD.
+internal u32 utf8_decode(u8** at, u8* end)
+{
+  u8* c = *at;
+  u32 result = 0xfffd;
+  u32 length = 1;
+
+  if(c[0] < 0x80)
+  {
+    result = c[0];
+  }
+  else
+  {
+    u32 expected_length = 0;
+    if((c[0] & 0xe0) == 0xc0)      { expected_length = 2; }
+    else if((c[0] & 0xf0) == 0xe0) { expected_length = 3; }
+    else if((c[0] & 0xf8) == 0xf0) { expected_length = 4; }
+
+    if(expected_length && c + expected_length <= end)
+    {
+      u32 codepoint = c[0] & (0x7f >> expected_length);
+      b32 valid = true;
+      for(u32 idx = 1;
+          idx < expected_length && valid;
+          ++idx)
+      {
+        valid = is_utf8_continuation(c[idx]);
+        codepoint = (codepoint << 6) | (c[idx] & 0x3f);
+      }
+
+      if(valid)
+      {
+        result = codepoint;
+        length = expected_length;
+      }
+    }
+  }
+
+  *at = c + length;
+  return result;
+}
+
+// Writes up to 4 bytes, returns the number written.
+internal u32 utf8_encode(u32 codepoint, u8* out)
+{
+  u32 length = 0;
+  if(codepoint < 0x80)
+  {
+    out[length++] = (u8)codepoint;
+  }
+  else if(codepoint < 0x800)
+  {
+    out[length++] = 0xc0 | (codepoint >> 6);
+    out[length++] = 0x80 | (codepoint & 0x3f);
+  }
+  else if(codepoint < 0x10000)
+  {
+    out[length++] = 0xe0 | (codepoint >> 12);
+    out[length++] = 0x80 | ((codepoint >> 6) & 0x3f);
+    out[length++] = 0x80 | (codepoint & 0x3f);
+  }
+  else
+  {
+    out[length++] = 0xf0 | (codepoint >> 18);
+    out[length++] = 0x80 | ((codepoint >> 12) & 0x3f);
+    out[length++] = 0x80 | ((codepoint >> 6) & 0x3f);
+    out[length++] = 0x80 | (codepoint & 0x3f);
+  }
+  return length;
+}
+
+internal u32 utf8_length(str_t str)
+{
+  u32 result = 0;
+  for(size_t i = 0;
+      i < str.size;
+      ++i)
+  {
+    result += !is_utf8_continuation(str.data[i]);
+  }
+  return result;
+}
+
+// Byte offset of the character count characters after byte offset start.
+internal size_t utf8_advance(str_t str, size_t start, i32 count)
+{
+  size_t result = min(str.size, start);
+  while(count > 0 && result < str.size)
+  {
+    ++result;
+    while(result < str.size && is_utf8_continuation(str.data[result]))
+    {
+      ++result;
+    }
+    --count;
+  }
+  return result;
+}
+
+// Byte offset of the start of the character before byte offset start.
+internal size_t utf8_previous(str_t str, size_t start)
+{
+  size_t result = min(str.size, start);
+  if(result > 0)
+  {
+    --result;
+    while(result > 0 && is_utf8_continuation(str.data[result]))
+    {
+      --result;
+    }
+  }
+  return result;
+}
+
+// Simple case mapping for Latin, Greek and Cyrillic.
+internal u32 codepoint_to_lower(u32 c)
+{
+  u32 result = c;
+
+  if(c < 0x80)
+  {
+    result = to_lower((u8)c);
+  }
+  else if((c >= 0xc0 && c <= 0xde && c != 0xd7) ||
+      (c >= 0x391 && c <= 0x3ab && c != 0x3a2) ||
+      (c >= 0x410 && c <= 0x42f))
+  {
+    result = c + 0x20;
+  }
+  else if(c >= 0x400 && c <= 0x40f)
+  {
+    result = c + 0x50;
+  }
+  else if((c >= 0x100 && c <= 0x137) || (c >= 0x14a && c <= 0x177))
+  {
+    result = c | 1;
+  }
+  else if((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17e))
+  {
+    result = (c & 1) ? c + 1 : c;
+  }
+  else if(c == 0x178)
+  {
+    result = 0xff;
+  }
+
+  return result;
+}
+
+// Compares by codepoints, with codepoint_to_lower's case mapping.
+internal b32 str_eq_nocase(str_t a, str_t b)
+{
+  u8* a_at = a.data;
+  u8* b_at = b.data;
+  u8* a_end = a.data + a.size;
+  u8* b_end = b.data + b.size;
+  b32 result = true;
+  while(a_at < a_end && b_at < b_end && result)
+  {
+    result = (codepoint_to_lower(utf8_decode(&a_at, a_end)) ==
+        codepoint_to_lower(utf8_decode(&b_at, b_end)));
+  }
+  return result && a_at == a_end && b_at == b_end;
+}
+
+// Output buffered in big blocks, for printing many small strings.
+typedef struct
+{
+  FILE* file;
+  size_t size;
+  u8 data[64 * 1024];
+} out_buf_t;
+
+internal void out_flush(out_buf_t* out)
+{
+  fwrite(out->data, 1, out->size, out->file);
+  out->size = 0;
+}
+
+internal void out_str(out_buf_t* out, str_t str)
+{
+  if(out->size + str.size > sizeof(out->data))
+  {
+    out_flush(out);
+  }
+
+  if(str.size > sizeof(out->data))
+  {
+    fwrite(str.data, 1, str.size, out->file);
+  }
+  else
+  {
+    for(size_t i = 0;
+        i < str.size;
+        ++i)
+    {
+      out->data[out->size++] = str.data[i];
+    }
+  }
+}
+
+internal void out_char(out_buf_t* out, u8 c)
+{
+  if(out->size + 1 > sizeof(out->data))
+  {
+    out_flush(out);
+  }
+  out->data[out->size++] = c;
+}